@@ -0,0 +1,125 @@
+//
+//  BriefDescriptor.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__BriefDescriptor__
+#define __kimproc__BriefDescriptor__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Keypoint.h"
+#include "HarrisLaplaceDetector.h"
+
+// side of the square patch the test pairs are sampled from
+#define BRIEF_PATCH_SIZE 31
+// number of the binary tests, multiple of 64
+#define BRIEF_BITS 256
+
+/**
+ @brief	256 bit binary descriptor, bit i is set if the i-th test pair of
+		the pattern has smaller intensity at the first point.
+ */
+struct BriefDescriptor
+{
+	uint64_t bits[BRIEF_BITS / 64];
+};
+
+/**
+ @brief	Pair of matched descriptors, query indexes the first and train the
+		second descriptor list.
+ */
+struct DescriptorMatch
+{
+	int query;
+	int train;
+	int distance;
+	
+	DescriptorMatch(int query, int train, int distance)
+	:query(query), train(train), distance(distance){}
+};
+
+/**
+ @brief	BRIEF descriptors (Calonder et al., ECCV 10) of keypoints, optionally
+		steered by the intensity centroid orientation as in ORB (Rublee et
+		al., ICCV 11). The descriptors are sampled from already smoothed
+		planes, e.g. the pyramid of HarrisLaplaceDetector, so the image is
+		not smoothed again.
+ */
+class BriefExtractor
+{
+public:
+	
+	/**
+	 @brief	Describes the keypoints on the smoothed pyramid of the detector
+			which found them, each keypoint is sampled on the level of its
+			scale.
+	 @param oriented	rotate the pattern by the intensity centroid
+						orientation of the patch.
+	 @return one descriptor for each keypoint, pixels outside of the level
+			are clamped to the border.
+	 */
+	static std::vector<BriefDescriptor> compute(const HarrisLaplaceDetector &pyramid,
+												const std::vector<Keypoint> &keypoints,
+												bool oriented = false);
+	
+	/**
+	 @brief	Describes point (x, y) of the smoothed plane.
+	 */
+	static BriefDescriptor describe(const float * smooth, int width, int height,
+									float x, float y, bool oriented = false);
+	
+	/**
+	 @brief	Angle of the vector from (x, y) to the intensity centroid of the
+			circular patch of radius BRIEF_PATCH_SIZE / 2.
+	 */
+	static float orientation(const float * smooth, int width, int height, int x, int y);
+	
+	static int hamming(const BriefDescriptor &a, const BriefDescriptor &b);
+	
+	/**
+	 @brief	Brute force matching by the Hamming distance, the queries are
+			split between threads.
+	 @param max_distance	matches with greater distance are dropped.
+	 @param cross_check		keep only pairs which are the nearest
+							neighbours of each other.
+	 */
+	static std::vector<DescriptorMatch> match(const std::vector<BriefDescriptor> &query,
+											  const std::vector<BriefDescriptor> &train,
+											  int max_distance = BRIEF_BITS / 4,
+											  bool cross_check = true);
+	
+	/**
+	 @brief	Saves the matched keypoint coordinates as CSV lines
+			x1,y1,x2,y2,distance.
+	 */
+	static void saveMatches(const std::string &path,
+							const std::vector<Keypoint> &query,
+							const std::vector<Keypoint> &train,
+							const std::vector<DescriptorMatch> &matches);
+	
+private:
+	
+	BriefExtractor(){}
+	
+	/**
+	 Test pairs x1, y1, x2, y2 relative to the patch center, drawn from
+	 isotropic gaussian with sigma BRIEF_PATCH_SIZE / 5 by a fixed seed, so
+	 the pattern is the same on every platform.
+	 */
+	static const std::vector<int> &pattern();
+	
+	/**
+	 Nearest neighbour of each query descriptor.
+	 */
+	static void nearest(const std::vector<BriefDescriptor> &query,
+						const std::vector<BriefDescriptor> &train,
+						std::vector<int> &index, std::vector<int> &distance);
+};
+
+#endif /* defined(__kimproc__BriefDescriptor__) */
@@ -0,0 +1,200 @@
+//
+//  BufferPool.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__BufferPool__
+#define __kimproc__BufferPool__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "ImageView.h"
+
+// alignment of the pooled buffers and of the rows of pooled planes, in bytes
+#define BUFFER_ALIGNMENT 64
+
+// default limit of the bytes held by the released blocks of the pool
+#define BUFFER_POOL_LIMIT (256 * 1024 * 1024)
+
+/**
+ @brief	Pool of BUFFER_ALIGNMENT aligned memory blocks keyed by their size.
+		Released blocks are kept and handed out again to requests of the
+		same (aligned) size, so processing of same sized frames does not
+		allocate after the first one. The kept blocks are limited in total
+		size, the least recently released ones are freed first, so that
+		sizes which are no longer requested do not stay cached. Thread
+		safe.
+ */
+class BufferPool
+{
+public:
+	
+	struct Stats
+	{
+		/** requests served by a released block */
+		size_t hits;
+		/** requests which had to allocate */
+		size_t misses;
+		/** bytes of the blocks held by the pool */
+		size_t cached_bytes;
+		/** bytes of the blocks handed out and not released yet */
+		size_t used_bytes;
+		/** released blocks freed to keep the pool under its limit */
+		size_t evictions;
+	};
+	
+	/**
+	 @param limit	maximal bytes of the released blocks kept by the pool.
+	 */
+	BufferPool(size_t limit = BUFFER_POOL_LIMIT);
+	
+	~BufferPool();
+	
+	/**
+	 @brief	Pool shared by the whole application.
+	 */
+	static BufferPool &global();
+	
+	/**
+	 @return aligned block of at least bytes bytes, throws std::bad_alloc.
+	 */
+	void * acquire(size_t bytes);
+	
+	/**
+	 @brief	Returns block obtained by acquire(bytes) to the pool.
+	 */
+	void release(void * block, size_t bytes);
+	
+	Stats stats() const;
+	
+	/**
+	 @brief	Sets the limit of the cached bytes, blocks over the limit are
+			freed immediately.
+	 */
+	void setLimit(size_t bytes);
+	
+	/**
+	 @brief	Frees all cached blocks.
+	 */
+	void clear();
+	
+	/**
+	 @return bytes rounded up to BUFFER_ALIGNMENT.
+	 */
+	static size_t alignedSize(size_t bytes)
+	{
+		return (bytes + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+	}
+	
+private:
+	
+	struct Block
+	{
+		void *ptr;
+		size_t bytes;
+	};
+	
+	BufferPool(const BufferPool &);
+	BufferPool &operator=(const BufferPool &);
+	
+	/**
+	 Frees the least recently released blocks until the cached bytes fit
+	 the limit, the mutex is held by the caller.
+	 */
+	void trim();
+	
+	mutable std::mutex mutex;
+	size_t limit;
+	/** released blocks, the most recently released first */
+	std::list<Block> released;
+	std::multimap<size_t, std::list<Block>::iterator> blocks;
+	Stats counters;
+};
+
+/**
+ @brief	Array of count elements of type T from the pool, returned to the
+		pool when the buffer goes out of scope. The elements are not
+		initialized.
+ */
+template <typename T>
+class PooledBuffer
+{
+public:
+	PooledBuffer(size_t count, BufferPool &pool = BufferPool::global())
+	:pool(&pool), count(count), bytes(BufferPool::alignedSize(count * sizeof(T)))
+	{
+		ptr = (T *)pool.acquire(bytes);
+	}
+	
+	PooledBuffer(PooledBuffer &&other)
+	:pool(other.pool), ptr(other.ptr), count(other.count), bytes(other.bytes)
+	{
+		other.ptr = NULL;
+	}
+	
+	~PooledBuffer()
+	{
+		if (ptr)
+			pool->release(ptr, bytes);
+	}
+	
+	T * data() const { return ptr; }
+	
+	size_t size() const { return count; }
+	
+	T & operator[](size_t i) const { return ptr[i]; }
+	
+private:
+	
+	PooledBuffer(const PooledBuffer &);
+	PooledBuffer &operator=(const PooledBuffer &);
+	
+	BufferPool *pool;
+	T *ptr;
+	size_t count;
+	size_t bytes;
+};
+
+/**
+ @brief	Image of Channels planes from the pool, every row starts at
+		BUFFER_ALIGNMENT aligned address (the rows are padded), returned to
+		the pool when it goes out of scope.
+ */
+template <typename T, int Channels = 1>
+class PooledPlane
+{
+public:
+	PooledPlane(unsigned int width, unsigned int height, BufferPool &pool = BufferPool::global())
+	:width(width), height(height),
+	stride(BufferPool::alignedSize(width * sizeof(T)) / sizeof(T)),
+	buffer(stride * height * Channels, pool)
+	{
+	}
+	
+	ImageView<T, Channels> view() const
+	{
+		return ImageView<T, Channels>(buffer.data(), width, height, stride, 1, stride * height);
+	}
+	
+	/**
+	 @brief	Shared CImg of the plane, only if the rows are not padded.
+	 */
+	cimg_library::CImg<T> sharedCImg() const { return view().toCImg(); }
+	
+	size_t rowStride() const { return stride; }
+	
+private:
+	unsigned int width;
+	unsigned int height;
+	size_t stride;
+	PooledBuffer<T> buffer;
+};
+
+#endif /* defined(__kimproc__BufferPool__) */
@@ -0,0 +1,100 @@
+//
+//  ColorConversion.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__ColorConversion__
+#define __kimproc__ColorConversion__
+
+#include <stdio.h>
+
+#include "CImg.h"
+#include "Image.h"
+#include "PixelTraits.h"
+#include "Parallel.h"
+
+// fractional bits of the fixed point luma weights
+#define LUMA_FRAC_BITS 14
+// round(0.299 * 2^14), round(0.587 * 2^14), 2^14 - the other two
+#define LUMA_WEIGHT_R 4899
+#define LUMA_WEIGHT_G 9617
+#define LUMA_WEIGHT_B 1868
+
+/**
+ @brief	Color conversions shared by the detectors and filters.
+ */
+class ColorConversion
+{
+public:
+	
+	/**
+	 @brief	Luma 0.299 R + 0.587 G + 0.114 B of count pixels from separate
+			channel planes, with fixed point weights (LUMA_FRAC_BITS) and
+			rounding. Processes 16 pixels per iteration with SSE2, the scalar
+			tail gives identical results.
+	 */
+	static void rgbToLuma(const unsigned char * r, const unsigned char * g,
+						  const unsigned char * b, unsigned char * luma, int count);
+	
+	/**
+	 @brief	Luma of planar CImg image, the rows are split between threads.
+			Single channel images are copied.
+	 */
+	static void rgbToLuma(const cimg_library::CImg<unsigned char> &src,
+						  cimg_library::CImg<unsigned char> &gray);
+	
+	/**
+	 @brief	Same as above into a view of the same size, e.g. a row padded
+			plane.
+	 */
+	static void rgbToLuma(const cimg_library::CImg<unsigned char> &src, Image &gray);
+	
+	/**
+	 @brief	Luma of 16 bit or float planar image into a view of the same
+			type, with the weights of the 8 bit version. Single channel
+			images are copied.
+	 */
+	template <typename T>
+	static void rgbToLuma(const cimg_library::CImg<T> &src, ImageView<T> &gray)
+	{
+		int width = src.width();
+		int rows = src.height() * src.depth();
+		assert(gray.width == (unsigned int)width && gray.height == (unsigned int)rows &&
+			   gray.contiguousRows());
+		size_t plane = (size_t)width * rows;
+		const T *r = src.data();
+		const T *g = src.spectrum() < 3 ? r : r + plane;
+		const T *b = src.spectrum() < 3 ? r : r + 2 * plane;
+		ImageView<T> out = gray;
+		Parallel::forRange(0, rows, [=](int from, int to)
+		{
+			const double scale = 1.0 / (1 << LUMA_FRAC_BITS);
+			for (int y = from; y < to; ++y)
+			{
+				size_t offset = (size_t)y * width;
+				T *dst = out.row(y);
+				for (int x = 0; x < width; ++x)
+				{
+					double v = LUMA_WEIGHT_R * (double)r[offset + x] + LUMA_WEIGHT_G * (double)g[offset + x] +
+							   LUMA_WEIGHT_B * (double)b[offset + x];
+					dst[x] = PixelTraits<T>::round(v * scale);
+				}
+			}
+		}, 256);
+	}
+	
+	/**
+	 @brief	Luma of count interleaved pixels with channels samples each,
+			e.g. rows of PPM files. Single channel pixels are copied.
+	 */
+	static void interleavedToLuma(const unsigned char * pixels, int channels,
+								  unsigned char * luma, int count);
+	
+private:
+	
+	ColorConversion(){}
+};
+
+#endif /* defined(__kimproc__ColorConversion__) */
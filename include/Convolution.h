@@ -12,15 +12,48 @@
 #include <stdio.h>
 #include <assert.h>
 #include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
 
 #include "Image.h"
+#include "Parallel.h"
 #include "CImg.h"
 
 #define DIR_VERT 0
 #define DIR_HORIZ 1
 
+// kernels with larger area are convolved in frequency domain by convolve2D,
+// the vectorized direct path is faster up to about 25x23 kernels
+#define FFT_KERNEL_AREA_THRESHOLD 600
+
+// number of kernel spectra kept by convolve2D, the least recently used is dropped
+#define FFT_KERNEL_CACHE_SIZE 16
+
+// default number of fractional bits of the quantized (Q1.14) kernels
+#define CONV_FRAC_BITS 14
+
+// maximal size of fixed point kernels, 256 taps of 8-bit pixels times
+// 16-bit coefficients sum to at most 255 * 32768 * 256 < 2^31, so the int32
+// accumulator can not overflow for any coefficients and frac_bits
+#define CONV_MAX_FIXED_TAPS 256
+
 using namespace cimg_library;
 
+/**
+ @brief	Kernel with integer coefficients known at compile time, to be used
+		with Convolution::convolve<K>(), e.g. IntKernel<-1, 1>.
+ */
+template <int... C>
+struct IntKernel
+{
+	static const unsigned int size = sizeof...(C);
+	static constexpr float coef[sizeof...(C)] = {(float)C...};
+};
+
+template <int... C>
+constexpr float IntKernel<C...>::coef[sizeof...(C)];
+
 class Convolution
 {
 public:
@@ -29,6 +62,373 @@ public:
 	static void convolve1D(Imagef &image, float * result, unsigned int kernel_size, float * kernel, int direction);
 	
 	static void convolve1D(CImg<float> &image, CImg<float> &result, unsigned int kernel_size, float * kernel, int direction);
+	
+	/**
+	 @brief	Quantizes float kernel to signed 16-bit fixed point values
+			qkernel[i] = round(kernel[i] * 2^frac_bits).
+	 @param frac_bits	number of fractional bits, at most 14 for kernels
+						with coefficients in <-1, 1>.
+	 @throws std::runtime_error if some coefficient does not fit into 16 bits.
+	 */
+	static void quantizeKernel(float * kernel, unsigned int kernel_size, short * qkernel, int frac_bits = CONV_FRAC_BITS);
+	
+	/**
+	 @brief	Fixed point version of convolve1D(Image &, float *, ...). Taps are
+			accumulated exactly in 32-bit integers, the sum is rounded to
+			integer (shifted right by frac_bits) and saturated to int16.
+			Compared to the float path the absolute error is bounded by
+			0.5 + 255 * kernel_size * 2^-(frac_bits + 1), i.e. less than 0.54
+			for the 5 tap gaussian in Q1.14, and derivative kernels with
+			integer coefficients are exact.
+	 @param qkernel		kernel quantized by quantizeKernel(), at most
+						CONV_MAX_FIXED_TAPS coefficients.
+	 @param frac_bits	fractional bits used to quantize qkernel.
+	 */
+	static void convolve1D(Image &image, short * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction);
+	
+	/**
+	 @brief	Same as the int16 version, but the result is saturated to <0, 255>.
+	 */
+	static void convolve1D(Image &image, unsigned char * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction);
+	
+	/**
+	 @brief	Same as convolve1D(Image &, ...), but the kernel size is a compile
+			time constant, so that the loops over the taps are fully unrolled
+			and the loops over pixels can be vectorized.
+	 */
+	template <unsigned int N>
+	static void convolve(Image &image, float * result, const float (&kernel)[N], int direction)
+	{
+		int width = image.width;
+		int height = image.height;
+		assert(image.contiguousRows());
+		
+		if (direction == DIR_VERT)
+		{
+			for (int y = 0; y < height; ++y)
+			{
+				const unsigned char *rows[N];
+				for (unsigned int t = 0; t < N; ++t)
+				{
+					int y_t = y - (int)t;
+					rows[t] = image.row(y_t >= 0 ? y_t : 0);
+				}
+				float *out = result + y * width;
+				for (int x = 0; x < width; ++x)
+				{
+					float res = 0;
+					for (unsigned int t = 0; t < N; ++t)
+					{
+						res += rows[t][x] * kernel[t];
+					}
+					out[x] = res;
+				}
+			}
+			return;
+		}
+		
+		int border = std::min((int)N - 1, width);
+		for (int y = 0; y < height; ++y)
+		{
+			const unsigned char *row = image.row(y);
+			float *out = result + y * width;
+			for (int x = 0; x < border; ++x)
+			{
+				float res = 0;
+				for (unsigned int s = 0; s < N; ++s)
+				{
+					int x_s = x - (int)s;
+					res += row[x_s >= 0 ? x_s : 0] * kernel[s];
+				}
+				out[x] = res;
+			}
+			for (int x = border; x < width; ++x)
+			{
+				float res = 0;
+				for (unsigned int s = 0; s < N; ++s)
+				{
+					res += row[x - s] * kernel[s];
+				}
+				out[x] = res;
+			}
+		}
+	}
+	
+	/**
+	 @brief	Compile time sized version of convolve1D(Imagef &, ...). The
+			result is written to the same (shifted) positions as the runtime
+			version, so it can be run in place (image.data == result) as well.
+	 */
+	template <unsigned int N>
+	static void convolve(Imagef &image, float * result, const float (&kernel)[N], int direction)
+	{
+		int width = image.width;
+		int height = image.height;
+		assert(image.contiguousRows());
+		
+		if (direction == DIR_VERT)
+		{
+			for (int y = 0; y < height; ++y)
+			{
+				int y_n = y - ((int)N - 1);
+				float *out = result + (y_n >= 0 ? y_n : 0) * width;
+				for (int x = 0; x < width; ++x)
+				{
+					float res = 0;
+					for (unsigned int t = 0; t < N; ++t)
+					{
+						int y_t = y - (int)t;
+						res += image.row(y_t >= 0 ? y_t : 0)[x] * kernel[t];
+					}
+					out[x] = res;
+				}
+			}
+			return;
+		}
+		
+		int border = std::min((int)N - 1, width);
+		for (int y = 0; y < height; ++y)
+		{
+			const float *row = image.row(y);
+			float *out = result + y * width;
+			for (int x = 0; x < border; ++x)
+			{
+				float res = 0;
+				for (unsigned int s = 0; s < N; ++s)
+				{
+					int x_s = x - (int)s;
+					res += row[x_s >= 0 ? x_s : 0] * kernel[s];
+				}
+				out[0] = res;
+			}
+			for (int x = border; x < width; ++x)
+			{
+				float res = 0;
+				for (unsigned int s = 0; s < N; ++s)
+				{
+					res += row[x - s] * kernel[s];
+				}
+				out[x - (N - 1)] = res;
+			}
+		}
+	}
+	
+	/**
+	 @brief	Compile time sized version of convolve1D(CImg<float> &, ...),
+			each channel is processed as a separate plane.
+	 */
+	template <unsigned int N>
+	static void convolve(CImg<float> &image, CImg<float> &result, const float (&kernel)[N], int direction)
+	{
+		assert(image.width() == result.width() &&
+			   image.height() == result.height() &&
+			   image.spectrum() == result.spectrum());
+		
+		int width = image.width();
+		int height = image.height();
+		int border = std::min((int)N - 1, width);
+		for (int c = 0; c < image.spectrum(); ++c)
+		{
+			for (int y = 0; y < height; ++y)
+			{
+				float *out = result.data(0, y, 0, c);
+				if (direction == DIR_VERT)
+				{
+					const float *rows[N];
+					for (unsigned int t = 0; t < N; ++t)
+					{
+						int y_t = y - (int)t;
+						rows[t] = image.data(0, y_t >= 0 ? y_t : 0, 0, c);
+					}
+					for (int x = 0; x < width; ++x)
+					{
+						float res = 0;
+						for (unsigned int t = 0; t < N; ++t)
+						{
+							res += rows[t][x] * kernel[t];
+						}
+						out[x] = res;
+					}
+					continue;
+				}
+				const float *row = image.data(0, y, 0, c);
+				for (int x = 0; x < border; ++x)
+				{
+					float res = 0;
+					for (unsigned int s = 0; s < N; ++s)
+					{
+						int x_s = x - (int)s;
+						res += row[x_s >= 0 ? x_s : 0] * kernel[s];
+					}
+					out[x] = res;
+				}
+				for (int x = border; x < width; ++x)
+				{
+					float res = 0;
+					for (unsigned int s = 0; s < N; ++s)
+					{
+						res += row[x - s] * kernel[s];
+					}
+					out[x] = res;
+				}
+			}
+		}
+	}
+	
+	/**
+	 @brief	Convolution with kernel K known at compile time (see IntKernel),
+			both the size and the coefficients are constant folded.
+	 */
+	template <typename K, typename I, typename R>
+	static void convolve(I &image, R &&result, int direction)
+	{
+		convolve<K::size>(image, result, K::coef, direction);
+	}
+	
+	/**
+	 @brief	Convolves single row with horizontal kernel,
+			out[x] = sum_s kernel[s] * row[x + anchor - s], where the
+			coordinates outside of the row are clamped to the border.
+			anchor = 0 gives the same result as convolve1D(Image &, ...),
+			anchor = kernel_size / 2 centers the kernel.
+	 */
+	static void convolveRow(const float * row, float * out, int width, unsigned int kernel_size, const float * kernel, int anchor);
+	
+	/**
+	 @brief	Vertical counterpart of convolveRow, out[x] = sum_t kernel[t] *
+			rows[t][x]. Selecting the (clamped) rows is left to the caller.
+	 */
+	static void combineRows(const float * const * rows, float * out, int width, unsigned int kernel_size, const float * kernel);
+	
+	/**
+	 @brief	2D convolution with single channel kernel centered at
+			(kernel.width() / 2, kernel.height() / 2), the borders are clamped.
+			Kernels with area above FFT_KERNEL_AREA_THRESHOLD are convolved
+			with FFTConvolver, the spectra of the FFT_KERNEL_CACHE_SIZE last
+			used kernels are cached, so applying the same kernel to many
+			images transforms it once. The rows are split between threads,
+			which read the rows around their range, so result has to be
+			another image than image.
+	 */
+	static void convolve2D(CImg<float> &image, CImg<float> &result, CImg<float> &kernel);
+	
+	/**
+	 @brief	Direct 2D convolution, see convolve2D().
+	 */
+	static void convolve2DDirect(CImg<float> &image, CImg<float> &result, CImg<float> &kernel);
+	
+	/**
+	 @brief	Box filter over (2 * radius + 1)^2 window, the borders are clamped.
+			The cost per pixel does not depend on the radius: the rows of the
+			window are kept in running column sums, which are then summed by
+			a running sum along the row. Accumulates in double, the rows are
+			split between threads, so the filter can not run in place, result
+			has to be another image of the same size.
+	 @param normalize	if true, the result is the mean of the window,
+						otherwise the sum.
+	 */
+	static void boxFilter(CImg<float> &image, CImg<float> &result, int radius, bool normalize = true);
+	
+	/**
+	 @brief	Integral image of each channel. The result has one extra zero row
+			and column, result(x + 1, y + 1, 0, c) is the sum of
+			image(0..x, 0..y, 0, c). Double accumulation is exact for 8-bit
+			images up to 2^37 pixels.
+	 */
+	template <typename T>
+	static void integralImage(const CImg<T> &image, CImg<double> &result)
+	{
+		result.assign(image.width() + 1, image.height() + 1, 1, image.spectrum());
+		for (int c = 0; c < image.spectrum(); ++c)
+		{
+			integral<T, false>(image.data(0, 0, 0, c), image.data(0, 0, 0, c),
+							   image.width(), image.height(), result.data(0, 0, 0, c));
+		}
+	}
+	
+	/**
+	 @brief	Integral image of squared values of each channel, see
+			integralImage().
+	 */
+	template <typename T>
+	static void integralImageSquared(const CImg<T> &image, CImg<double> &result)
+	{
+		result.assign(image.width() + 1, image.height() + 1, 1, image.spectrum());
+		for (int c = 0; c < image.spectrum(); ++c)
+		{
+			integral<T, true>(image.data(0, 0, 0, c), image.data(0, 0, 0, c),
+							  image.width(), image.height(), result.data(0, 0, 0, c));
+		}
+	}
+	
+	/**
+	 @brief	Single channel integral image of image(x, y, 0, c1) *
+			image(x, y, 0, c2), e.g. for covariances of color channels.
+	 */
+	template <typename T>
+	static void integralImageCross(const CImg<T> &image, int c1, int c2, CImg<double> &result)
+	{
+		assert(c1 < image.spectrum() && c2 < image.spectrum());
+		result.assign(image.width() + 1, image.height() + 1, 1, 1);
+		integral<T, true>(image.data(0, 0, 0, c1), image.data(0, 0, 0, c2),
+						  image.width(), image.height(), result.data());
+	}
+	
+	/**
+	 @brief	Sum over the rectangle <x1, x2> x <y1, y2> (inclusive) from the
+			integral image.
+	 */
+	static double boxSum(const CImg<double> &integral, int x1, int y1, int x2, int y2, int c = 0)
+	{
+		return integral(x2 + 1, y2 + 1, 0, c) - integral(x1, y2 + 1, 0, c)
+			 - integral(x2 + 1, y1, 0, c) + integral(x1, y1, 0, c);
+	}
+	
+private:
+	
+	/**
+	 Integral image of a (product == false) or a * b (product == true)
+	 planes, out has (width + 1) * (height + 1) elements. Rows are prefix
+	 summed in parallel, then the columns are accumulated in parallel
+	 stripes, with the inner loop running along the row.
+	 */
+	template <typename T, bool product>
+	static void integral(const T * a, const T * b, int width, int height, double * out)
+	{
+		int stride = width + 1;
+		std::fill(out, out + stride, 0.0);
+		Parallel::forRange(0, height, [=](int from, int to)
+		{
+			for (int y = from; y < to; ++y)
+			{
+				const T *ra = a + (size_t)y * width;
+				const T *rb = b + (size_t)y * width;
+				double *ro = out + (size_t)(y + 1) * stride;
+				double acc = 0;
+				ro[0] = 0;
+				for (int x = 0; x < width; ++x)
+				{
+					acc += product ? (double)ra[x] * (double)rb[x] : (double)ra[x];
+					ro[x + 1] = acc;
+				}
+			}
+		}, 64);
+		Parallel::forRange(1, stride, [=](int from, int to)
+		{
+			for (int y = 2; y <= height; ++y)
+			{
+				const double *prev = out + (size_t)(y - 1) * stride;
+				double *ro = out + (size_t)y * stride;
+				for (int x = from; x < to; ++x)
+				{
+					ro[x] += prev[x];
+				}
+			}
+		}, 256);
+	}
+	
+	template <typename T>
+	static void convolve1DFixed(Image &image, T * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction);
 };
 
 #endif /* defined(__kimproc__Convolution__) */
@@ -0,0 +1,228 @@
+//
+//  ConvolutionPipeline.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__ConvolutionPipeline__
+#define __kimproc__ConvolutionPipeline__
+
+#include <stdio.h>
+#include <assert.h>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "Convolution.h"
+
+/**
+ @brief	One stage of the ConvolutionPipeline. Stages receive image rows
+		from top to bottom and pass their output rows to the next stage.
+		A row with several channels stores the channels one after another,
+		channel c starts at row + c * width.
+ */
+class PipelineStage
+{
+public:
+	PipelineStage(int width, int in_channels, int out_channels);
+	
+	virtual ~PipelineStage() {}
+	
+	/**
+	 @brief	Receives next input row.
+	 */
+	virtual void push(const float * row) = 0;
+	
+	/**
+	 @brief	Called after the last row was pushed, stages delaying their output
+			emit the remaining rows here.
+	 */
+	virtual void finish();
+	
+	void setNext(PipelineStage * _next) { next = _next; }
+	
+	int inChannels() const { return in_channels; }
+	
+	int outChannels() const { return out_channels; }
+	
+	/**
+	 @return number of floats the stage keeps in its buffers.
+	 */
+	size_t bufferSize() const { return buffer.size(); }
+	
+protected:
+	
+	void emit(const float * row);
+	
+	int width;
+	int in_channels;
+	int out_channels;
+	PipelineStage *next;
+	
+	std::vector<float> buffer;
+};
+
+/**
+ @brief	Convolves the selected channels of each row with horizontal kernel,
+		see Convolution::convolveRow(). Other channels are passed through.
+ */
+class HorizontalStage : public PipelineStage
+{
+public:
+	HorizontalStage(int width, int channels, const float * kernel, unsigned int kernel_size,
+					int anchor, int first_channel, int num_channels);
+	
+	virtual void push(const float * row);
+	
+private:
+	std::vector<float> kernel;
+	int anchor;
+	int first_channel;
+	int num_channels;
+};
+
+/**
+ @brief	Convolves the selected channels with vertical kernel,
+		out[y] = sum_t kernel[t] * in[y + anchor - t], rows outside of the
+		image are clamped to the border. Only kernel_size rows are held in a
+		ring buffer (followed by the output row), the output is delayed by
+		anchor rows.
+ */
+class VerticalStage : public PipelineStage
+{
+public:
+	VerticalStage(int width, int channels, const float * kernel, unsigned int kernel_size,
+				  int anchor, int first_channel, int num_channels);
+	
+	virtual void push(const float * row);
+	
+	virtual void finish();
+	
+private:
+	
+	/**
+	 Emits output row y, using input rows clamped to <0, last>.
+	 */
+	void emitRow(int y, int last);
+	
+	float * ringRow(int y) { return &buffer[(y % kernel.size()) * width * in_channels]; }
+	
+	std::vector<float> kernel;
+	std::vector<const float *> rows;
+	int anchor;
+	int first_channel;
+	int num_channels;
+	int received;
+};
+
+/**
+ @brief	Pointwise operation on rows, e.g. products of derivatives. The
+		function receives input row, output row and width.
+ */
+class MapStage : public PipelineStage
+{
+public:
+	typedef std::function<void(const float *, float *, int)> MapFunction;
+	
+	MapStage(int width, int in_channels, int out_channels, MapFunction fn);
+	
+	virtual void push(const float * row);
+	
+private:
+	MapFunction fn;
+};
+
+/**
+ @brief	Last stage of the pipeline, hands every row with its index to the
+		callback.
+ */
+class SinkStage : public PipelineStage
+{
+public:
+	typedef std::function<void(int, const float *)> SinkFunction;
+	
+	SinkStage(int width, int channels, SinkFunction fn);
+	
+	virtual void push(const float * row);
+	
+	virtual void finish();
+	
+private:
+	SinkFunction fn;
+	int y;
+};
+
+/**
+ @brief	Streaming chain of filters. Rows are pushed through the stages one
+		by one, each stage keeps only the rows its kernel needs, so the
+		intermediate data of all stages stays in cache and the memory does
+		not depend on the image height.
+
+		Usage:
+			ConvolutionPipeline p(width, 1);
+			p.addHorizontal(kernel, 5, 2);
+			p.addVertical(kernel, 5, 2);
+			p.addSink(...);
+			for (each row) p.push(row);
+			p.finish();
+ */
+class ConvolutionPipeline
+{
+public:
+	/**
+	 @param width		width of the processed rows.
+	 @param channels	number of channels of the pushed rows.
+	 */
+	ConvolutionPipeline(int width, int channels);
+	
+	~ConvolutionPipeline();
+	
+	/**
+	 @brief	Adds horizontal convolution of channels
+			<first_channel, first_channel + num_channels), all channels by
+			default.
+	 */
+	void addHorizontal(const float * kernel, unsigned int kernel_size, int anchor,
+					   int first_channel = 0, int num_channels = -1);
+	
+	/**
+	 @brief	Adds vertical convolution, see addHorizontal().
+	 */
+	void addVertical(const float * kernel, unsigned int kernel_size, int anchor,
+					 int first_channel = 0, int num_channels = -1);
+	
+	void addMap(int out_channels, MapStage::MapFunction fn);
+	
+	void addSink(SinkStage::SinkFunction fn);
+	
+	/**
+	 @brief	Pushes next row of the image into the pipeline.
+	 */
+	void push(const float * row);
+	
+	/**
+	 @brief	Flushes the pipeline after the last row.
+	 */
+	void finish();
+	
+	/**
+	 @return number of floats held by all stages.
+	 */
+	size_t bufferSize() const;
+	
+private:
+	
+	ConvolutionPipeline(const ConvolutionPipeline &);
+	ConvolutionPipeline &operator=(const ConvolutionPipeline &);
+	
+	void add(PipelineStage * stage);
+	
+	int channels() const;
+	
+	int width;
+	int in_channels;
+	std::vector<PipelineStage *> stages;
+};
+
+#endif /* defined(__kimproc__ConvolutionPipeline__) */
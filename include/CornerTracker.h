@@ -0,0 +1,111 @@
+//
+//  CornerTracker.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__CornerTracker__
+#define __kimproc__CornerTracker__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "HarrisCornerDetector.h"
+#include "HarrisLaplaceDetector.h"
+
+/**
+ @brief	Corner tracked over the frames of a sequence.
+ */
+struct Track
+{
+	/** unique id of the track */
+	int id;
+	float x;
+	float y;
+	/** number of frames the corner was tracked, 0 when just detected */
+	int age;
+};
+
+/**
+ @brief	Tracks Harris corners over a frame sequence. The corners are
+		detected on keyframes and in grid cells left without corners, in
+		the other frames they are tracked by pyramidal Lucas-Kanade
+		(Bouguet's formulation). The pyramid and its gradient planes are
+		built once per frame and serve as the template of the next frame,
+		all buffers are reused between frames.
+ */
+class CornerTracker
+{
+public:
+	/**
+	 @param max_corners			number of corners to keep, split evenly
+								between the grid cells.
+	 @param keyframe_interval	every keyframe_interval-th frame refills all
+								cells with fewer corners than their share,
+								otherwise only empty cells are refilled.
+	 @param grid_size			the frame is split into grid_size^2 cells.
+	 @param threshold			minimal Harris response of new corners.
+	 @param levels				number of pyramid levels of the tracker.
+	 @param window				half size of the tracking window.
+	 */
+	CornerTracker(int max_corners = 500, int keyframe_interval = 10, int grid_size = 8,
+				  float threshold = 1000.0f, int levels = 3, int window = 7);
+	
+	/**
+	 @brief	Tracks the corners of the previous frame into gray and detects
+			new corners where needed.
+	 @return tracks alive in this frame.
+	 */
+	const std::vector<Track> &process(Image &gray);
+	
+	const std::vector<Track> &tracks() const { return current; }
+	
+	/**
+	 @return number of the processed frames.
+	 */
+	int frame() const { return frame_index; }
+	
+private:
+	
+	struct Gradient
+	{
+		std::vector<float> Ix;
+		std::vector<float> Iy;
+	};
+	
+	/**
+	 Central differences of the smoothed levels of pyramid into gradients.
+	 */
+	void computeGradients(const HarrisLaplaceDetector &pyramid, std::vector<Gradient> &gradients);
+	
+	/**
+	 Tracks point (x, y) of the previous pyramid to the current one, false
+	 if the point is lost.
+	 */
+	bool trackPoint(float x, float y, float &nx, float &ny) const;
+	
+	/**
+	 Detects corners in the cells with fewer than quota tracks.
+	 */
+	void detect(Image &gray, bool keyframe);
+	
+	int max_corners;
+	int keyframe_interval;
+	int grid_size;
+	float threshold;
+	int window;
+	int frame_index;
+	int next_id;
+	
+	HarrisLaplaceDetector pyramids[2];
+	std::vector<Gradient> gradients[2];
+	/** index of the current pyramid and gradients */
+	int cur;
+	
+	std::vector<Track> current;
+	std::vector<float> response_plane;
+};
+
+#endif /* defined(__kimproc__CornerTracker__) */
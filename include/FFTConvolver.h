@@ -0,0 +1,65 @@
+//
+//  FFTConvolver.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__FFTConvolver__
+#define __kimproc__FFTConvolver__
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdexcept>
+
+#include "CImg.h"
+
+using namespace cimg_library;
+
+/**
+ @brief	2D convolution with large kernels in the frequency domain.
+		The image is processed in tiles using overlap-save, so the size of
+		the transforms depends on the kernel, not on the image. The spectrum
+		of the kernel is computed once in the constructor, the same
+		FFTConvolver can be applied to any number of images.
+
+		result(x, y) = sum_{i, j} kernel(i, j) * image(x + cx - i, y + cy - j),
+		where (cx, cy) = (kernel.width() / 2, kernel.height() / 2) and
+		coordinates outside of the image are clamped to the border, the same
+		as Convolution::convolve2DDirect().
+ */
+class FFTConvolver
+{
+public:
+	/**
+	 @param kernel		single channel 2D kernel.
+	 @param fft_size	size of the (square) transform, power of two greater
+						than the kernel. 0 chooses it from the kernel size.
+	 */
+	FFTConvolver(const CImg<float> &kernel, int fft_size = 0);
+	
+	/**
+	 @brief	Convolves each channel of the image with the kernel into
+			result, which has to be another image than image.
+	 */
+	void apply(const CImg<float> &image, CImg<float> &result) const;
+	
+	int fftSize() const { return fft_size; }
+	
+private:
+	
+	/**
+	 Convolves output tile with top left corner (x0, y0) of channel c.
+	 */
+	void applyTile(const CImg<float> &image, CImg<float> &result,
+				   int x0, int y0, int c, CImg<float> &re, CImg<float> &im) const;
+	
+	int kernel_w, kernel_h;
+	int fft_size;
+	//number of valid output pixels of one tile in x and y
+	int tile_w, tile_h;
+	CImg<float> kernel_re;
+	CImg<float> kernel_im;
+};
+
+#endif /* defined(__kimproc__FFTConvolver__) */
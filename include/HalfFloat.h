@@ -0,0 +1,145 @@
+//
+//  HalfFloat.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__HalfFloat__
+#define __kimproc__HalfFloat__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+
+/**
+ IEEE 754 half precision value, used only for storage of intermediates,
+ the arithmetic is done in float after HalfFloat::toFloat().
+ */
+struct Half
+{
+	uint16_t bits;
+};
+
+/**
+ @brief	Conversions between float and half precision storage. The rows are
+		converted by vcvtps2ph and vcvtph2ps of F16C, always when compiled
+		with it (__F16C__, e.g. -mf16c), otherwise if the CPU supports it
+		(GCC and Clang on x86). The scalar fallback gives identical results:
+		round to nearest even, subnormals and infinities are kept, NaN
+		keeps its sign and the upper bits of its payload and becomes quiet.
+ */
+class HalfFloat
+{
+public:
+	
+	static Half fromFloat(float f)
+	{
+		uint32_t u;
+		memcpy(&u, &f, 4);
+		uint32_t sign = (u >> 16) & 0x8000;
+		u &= 0x7fffffff;
+		Half h;
+		if (u > 0x7f800000)
+		{
+			//NaN, quiet with the upper 9 bits of the payload
+			h.bits = 0x7e00 | ((u >> 13) & 0x1ff);
+		}
+		else if (u >= (127 + 16) << 23)
+		{
+			//overflow to infinity
+			h.bits = 0x7c00;
+		}
+		else if (u < 113 << 23)
+		{
+			//subnormal half or zero, adding the magic value rounds the
+			//mantissa at the position of the half subnormal
+			const uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+			float magic;
+			memcpy(&magic, &denorm_magic, 4);
+			float v;
+			memcpy(&v, &u, 4);
+			v += magic;
+			memcpy(&u, &v, 4);
+			h.bits = (uint16_t)(u - denorm_magic);
+		}
+		else
+		{
+			uint32_t odd = (u >> 13) & 1;
+			u += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+			h.bits = (uint16_t)(u >> 13);
+		}
+		h.bits |= sign;
+		return h;
+	}
+	
+	static float toFloat(Half h)
+	{
+		const uint32_t shifted_exp = 0x7c00 << 13;
+		uint32_t u = (uint32_t)(h.bits & 0x7fff) << 13;
+		uint32_t exp = u & shifted_exp;
+		u += (127 - 15) << 23;
+		if (exp == shifted_exp)
+		{
+			//infinity or NaN, NaN becomes quiet
+			u += (128 - 16) << 23;
+			if (h.bits & 0x3ff)
+				u |= 0x400000;
+		}
+		else if (exp == 0)
+		{
+			//subnormal, renormalized by the float subtraction
+			const uint32_t magic_bits = 113 << 23;
+			float magic;
+			memcpy(&magic, &magic_bits, 4);
+			u += 1 << 23;
+			float v;
+			memcpy(&v, &u, 4);
+			v -= magic;
+			memcpy(&u, &v, 4);
+		}
+		u |= (uint32_t)(h.bits & 0x8000) << 16;
+		float f;
+		memcpy(&f, &u, 4);
+		return f;
+	}
+	
+	/**
+	 @brief	Converts count floats to half precision.
+	 */
+	static void toHalf(const float * src, Half * dst, int count);
+	
+	/**
+	 @brief	Converts count half precision values to float.
+	 */
+	static void toFloat(const Half * src, float * dst, int count);
+	
+	/**
+	 @brief	Row of float values for a kernel: float storage is used
+			directly, half storage is converted into tmp.
+	 @return src or tmp.
+	 */
+	static const float * loadRow(const float * src, float * tmp, int count) { return src; }
+	
+	static const float * loadRow(const Half * src, float * tmp, int count)
+	{
+		toFloat(src, tmp, count);
+		return tmp;
+	}
+	
+	/**
+	 @brief	Stores row of float values computed by a kernel.
+	 */
+	static void storeRow(const float * src, float * dst, int count)
+	{
+		memcpy(dst, src, (size_t)count * sizeof(float));
+	}
+	
+	static void storeRow(const float * src, Half * dst, int count) { toHalf(src, dst, count); }
+	
+private:
+	
+	HalfFloat(){}
+};
+
+#endif /* defined(__kimproc__HalfFloat__) */
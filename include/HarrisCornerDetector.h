@@ -12,19 +12,189 @@
 #include <stdio.h>
 #include <cstdio>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
 
+// not used here, but has to precede CImg.h, X11 defines Success as well
 #include <Eigen/Dense>
 
 #include "CImg.h"
 
 #include "Image.h"
+#include "Keypoint.h"
+#include "PixelTraits.h"
+#include "ColorConversion.h"
+#include "BufferPool.h"
 #include "GaussianSampler.h"
 #include "Convolution.h"
+#include "ConvolutionPipeline.h"
+#include "Parallel.h"
+
+// sensitivity factor k of the Harris response det(A) - k * trace(A)^2
+#define HARRIS_K 0.00001f
 
 class HarrisCornerDetector
 {
 public:
-	static void detect(cimg_library::CImg<unsigned char> &image, int treshold);
+	/**
+	 Corner measure computed from the smoothed structure tensor
+	 A = [Ixx Ixy; Ixy Iyy].
+	 */
+	enum ResponseType
+	{
+		/** det(A) - k * trace(A)^2 */
+		HARRIS,
+		/** smaller eigenvalue of A (Shi-Tomasi, Good Features to Track) */
+		SHI_TOMASI
+	};
+	
+	/**
+	 @brief	Marks pixels with response above treshold in the first channel
+			of the image. The pixel type T is unsigned char, unsigned short
+			or float, the derivatives are scaled to the 8 bit range by
+			PixelTraits, so the thresholds do not depend on the type.
+	 */
+	template <typename T>
+	static void detect(cimg_library::CImg<T> &image, int treshold,
+					   ResponseType type = HARRIS);
+	
+	/**
+	 @brief	Detects corners as local maxima of the response above threshold.
+	 @param image		RGB image of unsigned char, unsigned short or float.
+	 @param threshold	minimal response of the corner.
+	 @param nms_radius	corner has to be maximum of the response in the
+						(2 * nms_radius + 1)^2 window.
+	 @param subpixel	refine the corners by refineSubpixel().
+	 @return corners in the order of rows.
+	 */
+	template <typename T>
+	static std::vector<Keypoint> detectKeypoints(cimg_library::CImg<T> &image,
+												 float threshold, int nms_radius = 1,
+												 ResponseType type = HARRIS,
+												 bool subpixel = false);
+	
+	/**
+	 @brief	Same as above for grayscale image.
+	 */
+	template <typename T>
+	static std::vector<Keypoint> detectKeypoints(ImageView<T> &gray, float threshold,
+												 int nms_radius = 1,
+												 ResponseType type = HARRIS,
+												 bool subpixel = false);
+	
+	/**
+	 Fills gray with count rows of the grayscale image starting at row y,
+	 the rows are requested from top to bottom, each exactly once.
+	 */
+	typedef std::function<void(int y, int count, unsigned char * gray)> GrayRowSource;
+	
+	/**
+	 @brief	Same as detectKeypoints() for images which do not fit in
+			memory. The image is processed in strips of strip_height rows,
+			each strip is extended by the halo the derivatives, the
+			gaussian and the non-maximum suppression need, so the keypoints
+			are the same as for the whole image, including those at the
+			strip seams. The halo rows are kept from the previous strip, the
+			source is asked for every row only once. Memory used is
+			proportional to width * (strip_height + 2 * nms_radius + 5).
+	 @return corners in the order of rows.
+	 @throws std::runtime_error if nms_radius is negative or strip_height
+			is not positive.
+	 */
+	static std::vector<Keypoint> detectKeypointsStreaming(GrayRowSource source, int width, int height,
+														  float threshold, int nms_radius = 1,
+														  int strip_height = 256,
+														  ResponseType type = HARRIS);
+	
+	/**
+	 @brief	Non-maximum suppression of the response R. The maximum over the
+			window is computed separably (horizontal max of rows, then
+			vertical max of the (2 * radius + 1) row maxima), pixels equal to
+			the maximum and greater than threshold are returned.
+	 @throws std::runtime_error if radius is negative.
+	 */
+	static std::vector<Keypoint> nonMaxSuppression(const float * R, int width, int height,
+												   int radius, float threshold);
+	
+	/**
+	 @brief	Refines the keypoint positions to sub-pixel accuracy by fitting
+			quadratic to the 3x3 neighbourhood of the response R, the
+			offset is the extremum of the fit, -H^-1 * g, with the gradient
+			and hessian from central differences. The response is updated
+			to the value of the fit. Keypoints at the border, or where the
+			fit is not a maximum or moves by more than a pixel, are left as
+			they are. The cost depends only on the number of keypoints.
+	 */
+	static void refineSubpixel(const float * R, int width, int height,
+							   std::vector<Keypoint> &keypoints);
+	
+	/**
+	 @brief	Visualizes the keypoints as red dots in the image.
+	 */
+	template <typename T>
+	static void drawKeypoints(cimg_library::CImg<T> &image,
+							  const std::vector<Keypoint> &keypoints)
+	{
+		for (size_t i = 0; i < keypoints.size(); ++i)
+		{
+			int x = (int)round(keypoints[i].x);
+			int y = (int)round(keypoints[i].y);
+			if (x >= 0 && y >= 0 && x < image.width() && y < image.height())
+			{
+				image(x, y, 0, 0) = PixelTraits<T>::max();
+			}
+		}
+	}
+	
+	/**
+	 Receives row index and the Harris response of the row.
+	 */
+	typedef std::function<void(int, const float *)> ResponseSink;
+	
+	/**
+	 @brief	Calculates Harris response of the rows <y_begin, y_end) of the
+			grayscale image in a single pass: the rows are streamed through
+			a ConvolutionPipeline of the derivatives, their products and the
+			separable gaussian, whose vertical stages keep only the rows of
+			their kernels. The memory needed does not depend on the image
+			height. The rows are split between threads, sink is
+			called for every row exactly once, in order within each thread.
+	 @param y_end	end of the row range, -1 for image height.
+	 */
+	template <typename T>
+	static void response(ImageView<T> &gray, ResponseSink sink, int y_begin = 0, int y_end = -1,
+						 ResponseType type = HARRIS);
+	
+	/**
+	 @brief	Calculates Harris response of the whole image into R, which has
+			to have gray.width * gray.height elements.
+	 */
+	template <typename T>
+	static void response(ImageView<T> &gray, float * R, ResponseType type = HARRIS);
+	
+private:
+	
+	/**
+	 Single threaded response of rows <y_begin, y_end).
+	 */
+	template <typename T>
+	static void responseRange(ImageView<T> &gray, ResponseSink &sink, int y_begin, int y_end,
+							  ResponseType type);
+	
+	/**
+	 Harris response from the smoothed structure tensor rows in closed form,
+	 Ixx * Iyy - Ixy^2 - k * (Ixx + Iyy)^2.
+	 */
+	static void harrisRow(const float * Ixx, const float * Ixy, const float * Iyy,
+						  float * R, int width);
+	
+	/**
+	 Smaller eigenvalue of the structure tensor,
+	 (Ixx + Iyy) / 2 - sqrt(((Ixx - Iyy) / 2)^2 + Ixy^2).
+	 */
+	static void shiTomasiRow(const float * Ixx, const float * Ixy, const float * Iyy,
+							 float * R, int width);
 };
 
 #endif /* defined(__kimproc__HarrisCornerDetector__) */
@@ -0,0 +1,145 @@
+//
+//  HarrisLaplaceDetector.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__HarrisLaplaceDetector__
+#define __kimproc__HarrisLaplaceDetector__
+
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include <memory>
+
+#include "BufferPool.h"
+#include "HarrisCornerDetector.h"
+#include "ImagePyramid.h"
+
+// the pyramid stops before the level width or height drops below this value
+#define HL_MIN_LEVEL_SIZE 16
+
+/**
+ @brief	Multi-scale Harris-Laplace detector (Mikolajczyk, Schmid, ICCV 01)
+		over a dyadic Gaussian pyramid. Every level is smoothed by the same
+		gaussian as the Harris integration window (sigma 1) and subsampled
+		by two, so level l corresponds to sigma 2^l of the input image.
+		Corners are detected on every level and kept only at the
+		characteristic scale, where the scale normalized Laplacian of
+		Gaussian reaches maximum over the neighbouring levels.
+
+		The level planes come from the BufferPool. The detector keeps the
+		levels between calls and takes its temporary planes from the pool,
+		so repeated frames of the same size, also in a new detector, do not
+		allocate the planes again. The keypoint lists are still allocated
+		per call.
+ */
+class HarrisLaplaceDetector
+{
+public:
+	/**
+	 @param octaves			maximal number of pyramid levels, the pyramid
+							ends earlier if the level gets smaller than
+							HL_MIN_LEVEL_SIZE.
+	 @param log_threshold	minimal absolute Laplacian of Gaussian at the
+							characteristic scale.
+	 @throws std::runtime_error if octaves is not positive.
+	 */
+	HarrisLaplaceDetector(int octaves = 4, float log_threshold = 0.0f);
+	
+	/**
+	 @brief	Detects corners in the grayscale image.
+	 @param threshold	minimal Harris response of the corner on its level.
+	 @param nms_radius	non-maximum suppression radius on each level.
+	 @return	keypoints in the input image coordinates, scale holds the
+				characteristic scale 2^level.
+	 */
+	std::vector<Keypoint> detect(Image &gray, float threshold, int nms_radius = 1,
+								 HarrisCornerDetector::ResponseType type = HarrisCornerDetector::HARRIS);
+	
+	/**
+	 @brief	Same as above for RGB image.
+	 */
+	std::vector<Keypoint> detect(cimg_library::CImg<unsigned char> &image, float threshold,
+								 int nms_radius = 1,
+								 HarrisCornerDetector::ResponseType type = HarrisCornerDetector::HARRIS);
+	
+	/**
+	 @brief	Same as above on the levels of shared pyramid, e.g. of an image
+			other modules process at several scales too. The levels are
+			converted to luma and rounded to 8 bits, the pyramid should be
+			gaussian with samples in <0, 255>.
+	 */
+	std::vector<Keypoint> detect(ImagePyramid &pyramid, float threshold, int nms_radius = 1,
+								 HarrisCornerDetector::ResponseType type = HarrisCornerDetector::HARRIS);
+	
+	/**
+	 @brief	Fills the pyramid from gray without detecting, the buffers are
+			only resized.
+	 */
+	void buildPyramid(Image &gray);
+	
+	/**
+	 @brief	Fills the pyramid from the levels of the shared pyramid.
+	 */
+	void buildPyramid(ImagePyramid &pyramid);
+	
+	/**
+	 @return number of levels built for the last image.
+	 */
+	int levelCount() const { return level_count; }
+	
+	/**
+	 @return level l of the last image smoothed by the sigma 1 gaussian,
+			e.g. for sampling descriptors without smoothing again.
+	 */
+	const float * smoothed(int l) const { return levels[l].smooth->data(); }
+	
+	int levelWidth(int l) const { return levels[l].width; }
+	
+	int levelHeight(int l) const { return levels[l].height; }
+	
+private:
+	
+	struct Level
+	{
+		int width;
+		int height;
+		std::shared_ptr<PooledBuffer<unsigned char> > image;
+		/** level image smoothed by the sigma 1 gaussian */
+		std::shared_ptr<PooledBuffer<float> > smooth;
+		std::vector<Keypoint> keypoints;
+		
+		Image view();
+	};
+	
+	/**
+	 Harris corners of the built levels at their characteristic scale.
+	 */
+	std::vector<Keypoint> detectLevels(float threshold, int nms_radius,
+									   HarrisCornerDetector::ResponseType type);
+	
+	/**
+	 Sets the size of level l, the buffers are only resized.
+	 */
+	void resizeLevel(int l, int width, int height);
+	
+	/**
+	 Smooths level l and subsamples it into level l + 1 if next is true.
+	 */
+	void smoothLevel(int l, bool next);
+	
+	/**
+	 Absolute value of the discrete Laplacian of the smoothed level at the
+	 nearest pixel, borders are clamped.
+	 */
+	float laplacian(int l, float x, float y) const;
+	
+	int octaves;
+	float log_threshold;
+	int level_count;
+	std::vector<Level> levels;
+};
+
+#endif /* defined(__kimproc__HarrisLaplaceDetector__) */
@@ -11,18 +11,16 @@
 
 #include <stdio.h>
 
-struct Image
-{
-	unsigned char * data;
-	unsigned int width;
-	unsigned int height;
-};
+#include "ImageView.h"
 
-struct Imagef
-{
-	float * data;
-	unsigned int width;
-	unsigned int height;
-};
+/**
+ Single channel 8 bit image, see ImageView.
+ */
+typedef ImageView<unsigned char> Image;
+
+/**
+ Single channel float image, see ImageView.
+ */
+typedef ImageView<float> Imagef;
 
 #endif /* defined(__kimproc__Image__) */
@@ -0,0 +1,257 @@
+//
+//  ImageCache.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__ImageCache__
+#define __kimproc__ImageCache__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CImg.h"
+#include "RawImage.h"
+
+/**
+ @brief	Decoded images keyed by their path, scale, modification time and
+		size, so that the operations of a single run decode each input
+		once. The image is decoded in the sample type of the file, the
+		other pixel types are converted from it on their first request
+		and kept with it. An image whose file changed since it was decoded
+		is decoded again. Raw images (see RawImage) are mapped, untiled
+		planar ones are shared with the mapping, which the cache keeps
+		open. With libjpeg (cimg_use_jpeg) JPEG files are read into
+		memory and decoded by the JpegPlugin, at reduced scale directly by
+		the scaled IDCT. Thread safe.
+ */
+class ImageCache
+{
+public:
+	
+	struct Stats
+	{
+		/** requests served by a decoded image */
+		size_t hits;
+		/** images decoded */
+		size_t misses;
+	};
+	
+	ImageCache();
+	
+	/**
+	 @brief	Cache shared by the whole application.
+	 */
+	static ImageCache &global();
+	
+	/**
+	 @return the decoded image, valid until the file changes or the cache
+			is cleared. It may be shared with a mapping, callers which
+			modify the pixels copy it, e.g. by img.assign(cached, false).
+			Throws if the image can not be loaded.
+	 @param scale	1, 2, 4 or 8, the image is decoded at 1 / scale of its
+					size, rounded up. Images other than JPEG are decoded at
+					full size and averaged.
+	 */
+	template <typename T>
+	const cimg_library::CImg<T> & get(const std::string &path, int scale = 1)
+	{
+		if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+			throw std::runtime_error("Unsupported scale, use 1, 2, 4 or 8.");
+		FileStamp stamp = fileStamp(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		Key key(path, scale);
+		std::map<Key, Entry>::iterator it = cache.find(key);
+		if (it != cache.end() && it->second.stamp == stamp)
+		{
+			++counters.hits;
+			return image<T>(it->second);
+		}
+		
+		++counters.misses;
+		Entry &entry = cache[key];
+		entry.stamp = stamp;
+		entry.u8.assign();
+		entry.u16.assign();
+		entry.f32.assign();
+		entry.raw.reset();
+		try
+		{
+			decode(path, scale, entry);
+			return image<T>(entry);
+		}
+		catch (...)
+		{
+			cache.erase(key);
+			throw;
+		}
+	}
+	
+	/**
+	 @brief	Decodes the image into img like get(), but without caching it,
+			e.g. for the frames of a sequence which are read only once.
+	 */
+	template <typename T>
+	static void load(const std::string &path, int scale, cimg_library::CImg<T> &img)
+	{
+		if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+			throw std::runtime_error("Unsupported scale, use 1, 2, 4 or 8.");
+		Entry entry;
+		decode(path, scale, entry);
+		//a mapped image is copied before the mapping is closed
+		if (entry.raw)
+			img.assign(image<T>(entry), false);
+		else
+			img.swap(image<T>(entry));
+	}
+	
+	/**
+	 @return maximal sample value of the image file, which the decoded
+			samples are in: maxval of PNM, 255 or 65535 (16 bit) of PNG,
+			the range of the pixel type of raw images (1 for float, see
+			PixelTraits) and 255 for other formats. E.g. 4095 for 12 bit
+			PNM, whose samples are decoded as 0 to 4095 whatever the image
+			type.
+	 */
+	static double sampleMax(const std::string &path);
+	
+	/**
+	 @brief	Releases all images.
+	 */
+	void clear();
+	
+	Stats stats() const;
+	
+private:
+	
+	typedef std::pair<std::string, int> Key;
+	
+	struct FileStamp
+	{
+		int64_t mtime;
+		int64_t size;
+		
+		bool operator==(const FileStamp &other) const
+		{
+			return mtime == other.mtime && size == other.size;
+		}
+	};
+	
+	struct Entry
+	{
+		FileStamp stamp;
+		/** mapping the image is shared with */
+		std::shared_ptr<RawImage> raw;
+		/** type the image was decoded in, the others are converted from it */
+		RawPixelType type;
+		cimg_library::CImg<unsigned char> u8;
+		cimg_library::CImg<unsigned short> u16;
+		cimg_library::CImg<float> f32;
+		
+		Entry()
+		:type(RAW_U8)
+		{
+		}
+		
+		cimg_library::CImg<unsigned char> & images(unsigned char *) { return u8; }
+		
+		cimg_library::CImg<unsigned short> & images(unsigned short *) { return u16; }
+		
+		cimg_library::CImg<float> & images(float *) { return f32; }
+	};
+	
+	ImageCache(const ImageCache &);
+	ImageCache &operator=(const ImageCache &);
+	
+	/**
+	 The decoded image of type T, converted from the decoded type on the
+	 first request, the samples keep the range of the file.
+	 */
+	template <typename T>
+	static cimg_library::CImg<T> & image(Entry &entry)
+	{
+		cimg_library::CImg<T> &img = entry.images((T *)NULL);
+		if (entry.type == RawPixelTypeOf<T>::value || !img.is_empty())
+			return img;
+		switch (entry.type)
+		{
+			case RAW_U8:
+				img.assign(entry.u8);
+				break;
+			case RAW_U16:
+				img.assign(entry.u16);
+				break;
+			default:
+				img.assign(entry.f32);
+				break;
+		}
+		return img;
+	}
+	
+	/**
+	 Decodes the image in the sample type of the file: the type of raw
+	 images, unsigned char for JPEG and for files with samples up to 255,
+	 unsigned short up to 65535, see sampleMax(). Images of reduced
+	 scale are averaged in this type too, like JPEG decoded by the scaled
+	 IDCT.
+	 */
+	static void decode(const std::string &path, int scale, Entry &entry);
+	
+	template <typename T>
+	static void decode(const std::string &path, int scale, Entry &entry, cimg_library::CImg<T> &img)
+	{
+		if (entry.raw)
+		{
+			if (scale == 1 && !entry.raw->isTiled() && entry.raw->layout() == RAW_PLANAR)
+			{
+				entry.raw->sharedCImg(img);
+				return;
+			}
+			entry.raw->toCImg(img);
+			entry.raw.reset();
+		}
+#ifdef cimg_use_jpeg
+		else if (isJpeg(path))
+		{
+			std::vector<unsigned char> data;
+			readFile(path, data);
+			img.load_jpeg_buffer_scaled(data.data(), (unsigned int)data.size(), scale);
+			return;
+		}
+#endif
+		else
+		{
+			img.assign(path.c_str());
+		}
+		if (scale > 1)
+		{
+			//moving average of scale x scale pixels
+			img.resize((img.width() + scale - 1) / scale, (img.height() + scale - 1) / scale,
+					   -100, -100, 2);
+		}
+	}
+	
+	/**
+	 @return true if the file starts with the JPEG SOI marker.
+	 */
+	static bool isJpeg(const std::string &path);
+	
+	static void readFile(const std::string &path, std::vector<unsigned char> &data);
+	
+	/**
+	 Modification time and size of the file, throws if it does not exist.
+	 */
+	static FileStamp fileStamp(const std::string &path);
+	
+	mutable std::mutex mutex;
+	std::map<Key, Entry> cache;
+	Stats counters;
+};
+
+#endif /* defined(__kimproc__ImageCache__) */
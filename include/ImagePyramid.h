@@ -0,0 +1,105 @@
+//
+//  ImagePyramid.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__ImagePyramid__
+#define __kimproc__ImagePyramid__
+
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include <mutex>
+
+#include "CImg.h"
+
+// the pyramid stops before the level width or height drops below this value
+#define PYRAMID_MIN_LEVEL_SIZE 16
+
+/**
+ @brief	Dyadic pyramid of planar float image whose levels are built on the
+		first request and kept, so that the modules working on the same
+		input share one pyramid instead of building their own. Every level
+		is the previous one filtered and subsampled by two, the level size
+		is ((w + 1) / 2) x ((h + 1) / 2). Laplacian levels are the
+		difference of the gaussian level and the expanded next level, the
+		last laplacian level is the last gaussian level. Thread safe, the
+		returned levels stay valid while the pyramid exists.
+ */
+class ImagePyramid
+{
+public:
+	
+	/**
+	 Filter applied before subsampling.
+	 */
+	enum Filter
+	{
+		/** 5 tap binomial 1 4 6 4 1 / 16, approximately gaussian with sigma 1 */
+		GAUSSIAN,
+		/** average of 2x2 pixels */
+		BOX
+	};
+	
+	/**
+	 @param image		level 0, shared, i.e. not copied, it has to exist
+						while the pyramid is used.
+	 @param max_levels	maximal number of levels, 0 for all levels down to
+						min_size.
+	 */
+	ImagePyramid(const cimg_library::CImg<float> &image, Filter filter = GAUSSIAN, int max_levels = 0,
+				 int min_size = PYRAMID_MIN_LEVEL_SIZE);
+	
+	int levelCount() const { return (int)gaussians.size(); }
+	
+	Filter filter() const { return type; }
+	
+	/**
+	 @return gaussian (or box filtered) level l, the levels up to l are
+			built if needed.
+	 */
+	const cimg_library::CImg<float> & level(int l);
+	
+	/**
+	 @return laplacian level l, level(l) - expand(level(l + 1)).
+	 */
+	const cimg_library::CImg<float> & laplacian(int l);
+	
+	/**
+	 @brief	Filters src by the filter and subsamples it by two into dst,
+			the rows are split between threads. The border is clamped.
+	 */
+	static void downsample(const cimg_library::CImg<float> &src, cimg_library::CImg<float> &dst,
+						   Filter filter = GAUSSIAN);
+	
+	/**
+	 @brief	Expands src into dst of width x height by the 1 4 6 4 1 / 8
+			kernel applied to src interleaved by zeros, i.e. the inverse of
+			the gaussian downsample up to the lost frequencies.
+	 */
+	static void expand(const cimg_library::CImg<float> &src, int width, int height,
+					   cimg_library::CImg<float> &dst);
+	
+private:
+	
+	ImagePyramid(const ImagePyramid &);
+	ImagePyramid &operator=(const ImagePyramid &);
+	
+	/**
+	 Downsamples row y of the output from rows of the channel plane in
+	 with the buffer tmp of width + 8 elements.
+	 */
+	static void downsampleRow(const float * in, int width, int height, int y, Filter filter,
+							  float * tmp, float * out, int out_width);
+	
+	Filter type;
+	std::mutex mutex;
+	std::vector<cimg_library::CImg<float> > gaussians;
+	std::vector<cimg_library::CImg<float> > laplacians;
+	/** number of gaussian levels built */
+	int built;
+};
+
+#endif /* defined(__kimproc__ImagePyramid__) */
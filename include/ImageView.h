@@ -0,0 +1,150 @@
+//
+//  ImageView.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__ImageView__
+#define __kimproc__ImageView__
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdexcept>
+
+#include "CImg.h"
+
+/**
+ Layout tag, each channel is stored in a separate plane (as in CImg).
+ */
+struct Planar {};
+
+/**
+ Layout tag, channels of a pixel are stored next to each other (RGBRGB...).
+ */
+struct Interleaved {};
+
+/**
+ @brief	Non-owning view of an image with Channels channels of type T. All
+		offsets are in elements: element (x, y, c) is at
+		data[y * stride + x * pixel_step + c * channel_step], so the view can
+		describe crops (stride greater than the row) and single channels of
+		both planar and interleaved images without copying.
+ */
+template <typename T, int Channels = 1, typename Layout = Planar>
+struct ImageView
+{
+	typedef T value_type;
+	typedef Layout layout;
+	static const int channels = Channels;
+	
+	T * data;
+	unsigned int width;
+	unsigned int height;
+	/** elements between the starts of two consecutive rows */
+	size_t stride;
+	/** elements between two horizontally neighbouring pixels */
+	size_t pixel_step;
+	/** elements between two channels of a pixel */
+	size_t channel_step;
+	
+	ImageView()
+	:data(NULL), width(0), height(0), stride(0), pixel_step(1), channel_step(0){}
+	
+	/**
+	 @brief	View of a packed image, rows follow each other without gaps and
+			planar channels follow each other without gaps.
+	 */
+	ImageView(T * data, unsigned int width, unsigned int height)
+	:data(data), width(width), height(height)
+	{
+		bool planar = isPlanar();
+		pixel_step = planar ? 1 : Channels;
+		stride = (size_t)width * pixel_step;
+		channel_step = planar ? stride * height : 1;
+	}
+	
+	ImageView(T * data, unsigned int width, unsigned int height, size_t stride,
+			  size_t pixel_step, size_t channel_step)
+	:data(data), width(width), height(height), stride(stride), pixel_step(pixel_step),
+	channel_step(channel_step){}
+	
+	static bool isPlanar() { return IsPlanar<Layout>::value; }
+	
+	T * row(int y) const { return data + (size_t)y * stride; }
+	
+	T & operator()(int x, int y, int c = 0) const
+	{
+		return data[(size_t)y * stride + (size_t)x * pixel_step + (size_t)c * channel_step];
+	}
+	
+	/**
+	 @return true if the pixels of a row are next to each other, so that
+			row(y)[x] addresses pixel x of the first channel.
+	 */
+	bool contiguousRows() const { return pixel_step == 1; }
+	
+	/**
+	 @return true if the view covers its memory without gaps, as a packed
+			planar CImg does.
+	 */
+	bool isPacked() const
+	{
+		return pixel_step == (isPlanar() ? 1u : (size_t)Channels) &&
+			   stride == (size_t)width * pixel_step &&
+			   (Channels == 1 || channel_step == (isPlanar() ? stride * height : 1));
+	}
+	
+	/**
+	 @brief	Zero copy view of the rectangle of w x h pixels at (x, y).
+	 */
+	ImageView roi(int x, int y, unsigned int w, unsigned int h) const
+	{
+		assert(x >= 0 && y >= 0 && x + w <= width && y + h <= height);
+		return ImageView(&(*this)(x, y), w, h, stride, pixel_step, channel_step);
+	}
+	
+	/**
+	 @brief	Zero copy view of channel c. Channel of an interleaved image
+			keeps its pixel_step, so its rows are not contiguous.
+	 */
+	ImageView<T, 1, Layout> channel(int c) const
+	{
+		assert(c >= 0 && c < Channels);
+		return ImageView<T, 1, Layout>(data + (size_t)c * channel_step, width, height,
+									   stride, pixel_step, channel_step);
+	}
+	
+	/**
+	 @brief	Zero copy view of the channels <first, first + Channels) of
+			planar CImg image.
+	 */
+	static ImageView fromCImg(cimg_library::CImg<T> &img, int first = 0)
+	{
+		assert(isPlanar() && first + Channels <= img.spectrum());
+		size_t plane = (size_t)img.width() * img.height() * img.depth();
+		return ImageView(img.data() + first * plane, img.width(), img.height() * img.depth(),
+						 img.width(), 1, plane);
+	}
+	
+	/**
+	 @brief	Shared (zero copy) CImg of the view, which has to be packed and
+			planar, see isPacked().
+	 */
+	cimg_library::CImg<T> toCImg() const
+	{
+		if (!isPlanar() || !isPacked())
+			throw std::runtime_error("ImageView::toCImg(): only packed planar views can be shared.");
+		return cimg_library::CImg<T>(data, width, height, 1, Channels, true);
+	}
+	
+private:
+	
+	template <typename L, typename Dummy = void>
+	struct IsPlanar { static const bool value = true; };
+	
+	template <typename Dummy>
+	struct IsPlanar<Interleaved, Dummy> { static const bool value = false; };
+};
+
+#endif /* defined(__kimproc__ImageView__) */
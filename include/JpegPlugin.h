@@ -0,0 +1,100 @@
+//
+//  JpegPlugin.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+// CImg plugin (cimg_plugin, set in CMakeLists.txt when libjpeg is found),
+// the file is included in the body of the CImg<T> class. It adds the
+// in-memory JPEG codec of the bundled jpeg_buffer plugin and decoding at
+// reduced size by the scaled IDCT of libjpeg.
+
+#ifndef __kimproc__JpegPlugin__
+#define __kimproc__JpegPlugin__
+
+// ERREXIT used by jpeg_buffer.h
+#include "jerror.h"
+#include "plugins/jpeg_buffer.h"
+
+/**
+ @brief	Decodes JPEG image from memory at 1 / scale of its size, scale is
+		1, 2, 4 or 8. libjpeg computes the reduced image directly by the
+		scaled IDCT, so the full resolution is never decoded. The size is
+		rounded up. Throws CImgIOException if the data can not be decoded.
+ */
+CImg<T>& load_jpeg_buffer_scaled(const JOCTET *const buffer, const unsigned buffer_size, const int scale)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct _cimg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr.original);
+	jerr.original.error_exit = _cimg_jpeg_error_exit;
+	if (setjmp(jerr.setjmp_buffer))
+	{
+		throw CImgIOException(_cimg_instance
+							  "load_jpeg_buffer_scaled(): Error message returned by libjpeg: %s.",
+							  cimg_instance, jerr.message);
+	}
+	
+	jpeg_create_decompress(&cinfo);
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+	//the memory source of libjpeg ends truncated data by a fake EOI marker
+	//like the file source, the one of jpeg_buffer.h rereads its last buffer
+	//forever
+	::jpeg_mem_src(&cinfo, const_cast<JOCTET *>(buffer), buffer_size);
+#else
+	jpeg_mem_src(&cinfo, const_cast<JOCTET *>(buffer), buffer_size);
+#endif
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = scale;
+	jpeg_start_decompress(&cinfo);
+	
+	const int components = cinfo.output_components;
+	if (components != 1 && components != 3 && components != 4)
+	{
+		jpeg_destroy_decompress(&cinfo);
+		throw CImgIOException(_cimg_instance
+							  "load_jpeg_buffer_scaled(): Unsupported number of components %d.",
+							  cimg_instance, components);
+	}
+	assign(cinfo.output_width, cinfo.output_height, 1, components);
+	CImg<ucharT> row(cinfo.output_width * components);
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+		const int y = cinfo.output_scanline;
+		JSAMPROW row_pointer = row._data;
+		//0 rows are returned only by a suspending data source, the memory
+		//source never suspends, so the data are broken
+		if (jpeg_read_scanlines(&cinfo, &row_pointer, 1) != 1)
+		{
+			jpeg_destroy_decompress(&cinfo);
+			throw CImgIOException(_cimg_instance
+								  "load_jpeg_buffer_scaled(): Unable to read row %d.",
+								  cimg_instance, y);
+		}
+		for (int c = 0; c < components; ++c)
+		{
+			T *dst = data(0, y, 0, c);
+			const unsigned char *src = row._data + c;
+			for (int x = 0; x < width(); ++x)
+			{
+				dst[x] = (T)src[x * components];
+			}
+		}
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return *this;
+}
+
+/**
+ @brief	Same as above, new instance.
+ */
+static CImg<T> get_load_jpeg_buffer_scaled(const JOCTET *const buffer, const unsigned buffer_size,
+										   const int scale)
+{
+	return CImg<T>().load_jpeg_buffer_scaled(buffer, buffer_size, scale);
+}
+
+#endif /* defined(__kimproc__JpegPlugin__) */
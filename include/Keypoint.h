@@ -0,0 +1,62 @@
+//
+//  Keypoint.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__Keypoint__
+#define __kimproc__Keypoint__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+/**
+ @brief	Detected image feature.
+ */
+struct Keypoint
+{
+	float x;
+	float y;
+	/** detector response at the keypoint */
+	float response;
+	/** standard deviation of the integration gaussian the keypoint was
+	 detected with */
+	float scale;
+	
+	Keypoint()
+	:x(0), y(0), response(0), scale(1){}
+	
+	Keypoint(float x, float y, float response, float scale = 1.0f)
+	:x(x), y(y), response(response), scale(scale){}
+};
+
+/**
+ @brief	Saving and loading of keypoint lists. The binary format is the
+		magic "KPTS", uint32 version, uint32 count followed by count records
+		of float x, y, response, scale, all in the byte order of the host.
+ */
+class KeypointIO
+{
+public:
+	
+	/**
+	 @brief	Saves keypoints as CSV if the path ends with .csv, in the binary
+			format otherwise.
+	 */
+	static void save(const std::string &path, const std::vector<Keypoint> &keypoints);
+	
+	static void saveCSV(const std::string &path, const std::vector<Keypoint> &keypoints);
+	
+	static void saveBinary(const std::string &path, const std::vector<Keypoint> &keypoints);
+	
+	static std::vector<Keypoint> loadBinary(const std::string &path);
+	
+private:
+	
+	KeypointIO(){}
+};
+
+#endif /* defined(__kimproc__Keypoint__) */
@@ -0,0 +1,65 @@
+//
+//  KeypointSelector.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__KeypointSelector__
+#define __kimproc__KeypointSelector__
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include "Keypoint.h"
+
+/**
+ @brief	Selects fixed number of well distributed keypoints from the
+		candidates (e.g. all local maxima of the response), instead of
+		tuning the response threshold.
+ */
+class KeypointSelector
+{
+public:
+	
+	/**
+	 @brief	Splits the image into grid_cols x grid_rows cells and takes the
+			total / (number of cells) strongest candidates from each cell.
+			The budget left by cells with fewer candidates is filled with the
+			strongest of the remaining candidates. Runs in linear time, the
+			candidates are bucketed by counting sort and each cell is
+			partially sorted with nth_element.
+	 @return at most total keypoints sorted by response, strongest first.
+	 */
+	static std::vector<Keypoint> selectBucketed(const std::vector<Keypoint> &candidates,
+												int width, int height, int total,
+												int grid_cols, int grid_rows);
+	
+	/**
+	 @brief	selectBucketed() with grid of about total / 8 cells of the same
+			aspect ratio as the image.
+	 */
+	static std::vector<Keypoint> selectBucketed(const std::vector<Keypoint> &candidates,
+												int width, int height, int total);
+	
+	/**
+	 @brief	Adaptive non-maximal suppression (Brown, Szeliski, Winder, CVPR
+			05). Each candidate gets the distance to the nearest candidate
+			that is sufficiently stronger (response * robust > own
+			response), the total candidates with the largest distance are
+			returned. The nearest stronger candidate is looked up in a grid,
+			which is filled in the order of decreasing response.
+	 @return at most total keypoints sorted by suppression radius, largest
+			first.
+	 */
+	static std::vector<Keypoint> selectANMS(const std::vector<Keypoint> &candidates,
+											int width, int height, int total,
+											float robust = 0.9f);
+	
+private:
+	
+	KeypointSelector(){}
+};
+
+#endif /* defined(__kimproc__KeypointSelector__) */
@@ -0,0 +1,202 @@
+//
+//  LayoutConversion.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__LayoutConversion__
+#define __kimproc__LayoutConversion__
+
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "ImageView.h"
+#include "BufferPool.h"
+#include "Parallel.h"
+
+/**
+ @brief	Conversions between planar and interleaved 8 bit images with 3
+		(RGB) or 4 (RGBA) channels. The SSE2 paths deinterleave by repeated
+		byte riffles (unpacklo/hi of the two halves of a block) and
+		interleave by the inverse unriffles (pack of the even and odd bytes),
+		32 RGB or 16 RGBA pixels per iteration.
+ */
+class LayoutConversion
+{
+public:
+	
+	/**
+	 @brief	Splits count interleaved pixels with channels (3 or 4) samples
+			into the planes.
+	 */
+	static void interleavedToPlanar(const unsigned char * src, int channels,
+									unsigned char * const * planes, int count);
+	
+	/**
+	 @brief	Inverse of interleavedToPlanar().
+	 */
+	static void planarToInterleaved(const unsigned char * const * planes, int channels,
+									unsigned char * dst, int count);
+	
+	/**
+	 @brief	Adds constant alpha to count RGB pixels.
+	 */
+	static void rgbToRgba(const unsigned char * rgb, unsigned char * rgba, int count,
+						  unsigned char alpha = 255);
+	
+	/**
+	 @brief	Drops the alpha of count RGBA pixels.
+	 */
+	static void rgbaToRgb(const unsigned char * rgba, unsigned char * rgb, int count);
+	
+	/**
+	 @brief	Converts the view src to dst of the same size, the rows are
+			split between threads. Any layouts and strides are accepted,
+			8 bit rows with contiguous pixels use the SIMD paths.
+	 */
+	template <typename T, int C, typename L1, typename L2>
+	static void convert(const ImageView<T, C, L1> &src, const ImageView<T, C, L2> &dst)
+	{
+		assert(src.width == dst.width && src.height == dst.height);
+		Parallel::forRange(0, src.height, [&](int from, int to)
+		{
+			for (int y = from; y < to; ++y)
+			{
+				convertRow(src, dst, y);
+			}
+		}, 64);
+	}
+	
+private:
+	
+	LayoutConversion(){}
+	
+	template <typename T, int C, typename L1, typename L2>
+	static void convertRow(const ImageView<T, C, L1> &src, const ImageView<T, C, L2> &dst, int y)
+	{
+		copyRow(src, dst, y);
+	}
+	
+	template <int C>
+	static void convertRow(const ImageView<unsigned char, C, Interleaved> &src,
+						   const ImageView<unsigned char, C, Planar> &dst, int y)
+	{
+		if ((C == 3 || C == 4) && src.pixel_step == C && dst.pixel_step == 1)
+		{
+			unsigned char *planes[C];
+			for (int c = 0; c < C; ++c)
+				planes[c] = &dst(0, y, c);
+			interleavedToPlanar(src.row(y), C, planes, src.width);
+			return;
+		}
+		copyRow(src, dst, y);
+	}
+	
+	template <int C>
+	static void convertRow(const ImageView<unsigned char, C, Planar> &src,
+						   const ImageView<unsigned char, C, Interleaved> &dst, int y)
+	{
+		if ((C == 3 || C == 4) && src.pixel_step == 1 && dst.pixel_step == C)
+		{
+			const unsigned char *planes[C];
+			for (int c = 0; c < C; ++c)
+				planes[c] = &src(0, y, c);
+			planarToInterleaved(planes, C, dst.row(y), src.width);
+			return;
+		}
+		copyRow(src, dst, y);
+	}
+	
+	template <typename T, int C, typename L1, typename L2>
+	static void copyRow(const ImageView<T, C, L1> &src, const ImageView<T, C, L2> &dst, int y)
+	{
+		if (src.pixel_step == 1 && dst.pixel_step == 1)
+		{
+			for (int c = 0; c < C; ++c)
+			{
+				std::copy(&src(0, y, c), &src(0, y, c) + src.width, &dst(0, y, c));
+			}
+			return;
+		}
+		for (unsigned int x = 0; x < src.width; ++x)
+		{
+			for (int c = 0; c < C; ++c)
+			{
+				dst(x, y, c) = src(x, y, c);
+			}
+		}
+	}
+};
+
+/**
+ @brief	Planar CImg image of type T which provides its pixels in the layout the
+		kernel prefers. Kernels declare the preferred layout by
+		typedef Planar PreferredLayout or typedef Interleaved PreferredLayout,
+		the image is converted on the first request only and the converted
+		copy is shared by all kernels preferring the same layout.
+ */
+template <typename T, int Channels>
+class LayeredImage
+{
+public:
+	LayeredImage(cimg_library::CImg<T> &image)
+	:image(image), interleaved(NULL)
+	{
+		assert(image.spectrum() >= Channels);
+	}
+	
+	~LayeredImage() { delete interleaved; }
+	
+	/**
+	 @return view of the image in the layout preferred by the kernel K.
+	 */
+	template <typename K>
+	ImageView<T, Channels, typename K::PreferredLayout> viewFor()
+	{
+		return view<typename K::PreferredLayout>();
+	}
+	
+	template <typename Layout>
+	ImageView<T, Channels, Layout> view()
+	{
+		return View<Layout, void>::get(*this);
+	}
+	
+private:
+	
+	LayeredImage(const LayeredImage &);
+	LayeredImage &operator=(const LayeredImage &);
+	
+	template <typename Layout, typename Dummy>
+	struct View
+	{
+		static ImageView<T, Channels, Planar> get(LayeredImage &li)
+		{
+			return ImageView<T, Channels, Planar>::fromCImg(li.image);
+		}
+	};
+	
+	template <typename Dummy>
+	struct View<Interleaved, Dummy>
+	{
+		static ImageView<T, Channels, Interleaved> get(LayeredImage &li)
+		{
+			int w = li.image.width();
+			int h = li.image.height();
+			if (!li.interleaved)
+			{
+				li.interleaved = new PooledBuffer<T>((size_t)w * h * Channels);
+				LayoutConversion::convert(ImageView<T, Channels, Planar>::fromCImg(li.image),
+										  ImageView<T, Channels, Interleaved>(li.interleaved->data(), w, h));
+			}
+			return ImageView<T, Channels, Interleaved>(li.interleaved->data(), w, h);
+		}
+	};
+	
+	cimg_library::CImg<T> &image;
+	PooledBuffer<T> *interleaved;
+};
+
+#endif /* defined(__kimproc__LayoutConversion__) */
@@ -0,0 +1,67 @@
+//
+//  Parallel.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__Parallel__
+#define __kimproc__Parallel__
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+class Parallel
+{
+public:
+	
+	/**
+	 @brief	Splits <begin, end) into contiguous ranges and calls fn(from, to)
+			for each of them in separate thread. Runs in the calling thread
+			if the range is shorter than 2 * min_chunk.
+	 @param min_chunk	the minimal length of the range processed by one
+						thread, so that small images are not split.
+	 */
+	static void forRange(int begin, int end, std::function<void(int, int)> fn,
+						 int min_chunk = 1)
+	{
+		int count = end - begin;
+		int threads = std::min((int)std::thread::hardware_concurrency(),
+							   count / std::max(min_chunk, 1));
+		if (threads <= 1)
+		{
+			if (count > 0)
+				fn(begin, end);
+			return;
+		}
+		
+		std::vector<std::thread> workers;
+		int from = begin;
+		for (int i = 0; i < threads; ++i)
+		{
+			int to = begin + (int)((long long)count * (i + 1) / threads);
+			if (i == threads - 1)
+			{
+				//the last range is done by the calling thread
+				fn(from, to);
+			}
+			else
+			{
+				workers.push_back(std::thread(fn, from, to));
+			}
+			from = to;
+		}
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			workers[i].join();
+		}
+	}
+	
+private:
+	
+	Parallel(){}
+};
+
+#endif /* defined(__kimproc__Parallel__) */
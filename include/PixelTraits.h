@@ -0,0 +1,74 @@
+//
+//  PixelTraits.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__PixelTraits__
+#define __kimproc__PixelTraits__
+
+#include <stdio.h>
+#include <cmath>
+
+/**
+ @brief	Compile time value range of the pixel type T, so that the filters
+		run on 8 bit, 16 bit and float images natively. Integer pixels use
+		their whole range, float pixels are in <0, 1>. The conversions from
+		double clamp to the range.
+ */
+template <typename T>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<unsigned char>
+{
+	static const bool is_integer = true;
+	static unsigned char min() { return 0; }
+	static unsigned char max() { return 255; }
+	
+	static unsigned char round(double v)
+	{
+		return v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char)(v + 0.5);
+	}
+	
+	static unsigned char truncate(double v)
+	{
+		return v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char)std::floor(v);
+	}
+};
+
+template <>
+struct PixelTraits<unsigned short>
+{
+	static const bool is_integer = true;
+	static unsigned short min() { return 0; }
+	static unsigned short max() { return 65535; }
+	
+	static unsigned short round(double v)
+	{
+		return v <= 0 ? 0 : v >= 65535 ? 65535 : (unsigned short)(v + 0.5);
+	}
+	
+	static unsigned short truncate(double v)
+	{
+		return v <= 0 ? 0 : v >= 65535 ? 65535 : (unsigned short)std::floor(v);
+	}
+};
+
+template <>
+struct PixelTraits<float>
+{
+	static const bool is_integer = false;
+	static float min() { return 0.0f; }
+	static float max() { return 1.0f; }
+	
+	static float round(double v)
+	{
+		return v <= 0 ? 0.0f : v >= 1 ? 1.0f : (float)v;
+	}
+	
+	static float truncate(double v) { return round(v); }
+};
+
+#endif /* defined(__kimproc__PixelTraits__) */
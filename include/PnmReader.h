@@ -0,0 +1,69 @@
+//
+//  PnmReader.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__PnmReader__
+#define __kimproc__PnmReader__
+
+#include <stdio.h>
+#include <string>
+#include <stdexcept>
+
+/**
+ @brief	Sequential reader of binary PGM (P5) and PPM (P6) images with 8 bit
+		samples, rows are read on demand so that the whole image never has
+		to be in memory.
+ */
+class PnmReader
+{
+public:
+	/**
+	 @brief	Opens the file and parses the header, throws runtime_error if
+			the file is not 8 bit binary PGM or PPM.
+	 */
+	PnmReader(const std::string &path);
+	
+	~PnmReader();
+	
+	int width() const { return w; }
+	
+	int height() const { return h; }
+	
+	/**
+	 @return 1 for PGM, 3 for PPM.
+	 */
+	int channels() const { return c; }
+	
+	/**
+	 @return index of the next row to be read.
+	 */
+	int row() const { return next_row; }
+	
+	/**
+	 @brief	Reads next count rows of interleaved samples into out, which has
+			to hold count * width * channels bytes.
+	 */
+	void readRows(unsigned char * out, int count);
+	
+private:
+	
+	PnmReader(const PnmReader &);
+	PnmReader &operator=(const PnmReader &);
+	
+	/**
+	 Next header token, comments are skipped.
+	 */
+	int headerValue();
+	
+	FILE *f;
+	std::string path;
+	int w;
+	int h;
+	int c;
+	int next_row;
+};
+
+#endif /* defined(__kimproc__PnmReader__) */
@@ -0,0 +1,350 @@
+//
+//  RawImage.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__RawImage__
+#define __kimproc__RawImage__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include "CImg.h"
+#include "ImageView.h"
+#include "LayoutConversion.h"
+
+#define RAW_VERSION 1
+// the samples start at the first page after the header, so that the
+// mapping of the samples is page aligned
+#define RAW_DATA_OFFSET 4096
+
+/**
+ Sample type of the raw image.
+ */
+enum RawPixelType
+{
+	RAW_U8 = 1,
+	RAW_U16 = 2,
+	RAW_F32 = 3
+};
+
+/**
+ Layout of the samples within a tile.
+ */
+enum RawLayout
+{
+	RAW_PLANAR = 0,
+	RAW_INTERLEAVED = 1
+};
+
+template <typename T> struct RawPixelTypeOf;
+template <> struct RawPixelTypeOf<unsigned char> { static const RawPixelType value = RAW_U8; };
+template <> struct RawPixelTypeOf<unsigned short> { static const RawPixelType value = RAW_U16; };
+template <> struct RawPixelTypeOf<float> { static const RawPixelType value = RAW_F32; };
+
+/**
+ Header of the raw image file, all values in the byte order of the host.
+ */
+struct RawHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	/** RawPixelType */
+	uint32_t type;
+	/** RawLayout */
+	uint32_t layout;
+	uint32_t tile_width;
+	uint32_t tile_height;
+	uint64_t data_offset;
+};
+
+/**
+ @brief	Uncompressed image container which is memory mapped instead of
+		decoded. The file is the RawHeader, padded to RAW_DATA_OFFSET,
+		followed by the tiles in the order of rows. Every tile has
+		tile_width x tile_height pixels, the tiles at the right and bottom
+		border are padded, and holds its samples planar or interleaved.
+		Untiled image is a single tile of the image size.
+		The mapping is opened read only as a private copy on write mapping,
+		so the kernels can run on the page cache directly and concurrent
+		processes share a single physical copy of the file, as long as
+		they do not write to it. Writable images are mapped shared, the
+		changes go to the file.
+ */
+class RawImage
+{
+public:
+	
+	RawImage();
+	
+	/**
+	 @brief	Maps the raw image file, see open().
+	 */
+	RawImage(const std::string &path, bool writable = false);
+	
+	~RawImage();
+	
+	/**
+	 @brief	Maps the raw image file, throws runtime_error if it can not be
+			opened or is not a valid raw image.
+	 @param writable	map the file shared, so that the changes of the
+						pixels are written to the file.
+	 */
+	void open(const std::string &path, bool writable = false);
+	
+	void close();
+	
+	/**
+	 @brief	Creates raw image file with zero samples and maps it writable.
+	 @param tile_width	width of the tiles, 0 for untiled image.
+	 @param tile_height	height of the tiles, 0 for untiled image.
+	 */
+	void create(const std::string &path, int width, int height, int channels, RawPixelType type,
+				RawLayout layout, int tile_width = 0, int tile_height = 0);
+	
+	/**
+	 @return true if the file starts with the raw image magic.
+	 */
+	static bool isRaw(const std::string &path);
+	
+	bool isOpen() const { return map != NULL; }
+	
+	/**
+	 @return true if the changes of the samples are written to the file.
+	 */
+	bool isWritable() const { return writable; }
+	
+	int width() const { return header.width; }
+	
+	int height() const { return header.height; }
+	
+	int channels() const { return header.channels; }
+	
+	RawPixelType pixelType() const { return (RawPixelType)header.type; }
+	
+	RawLayout layout() const { return (RawLayout)header.layout; }
+	
+	int tileWidth() const { return header.tile_width; }
+	
+	int tileHeight() const { return header.tile_height; }
+	
+	int tilesX() const { return (int)(((uint64_t)header.width + header.tile_width - 1) / header.tile_width); }
+	
+	int tilesY() const { return (int)(((uint64_t)header.height + header.tile_height - 1) / header.tile_height); }
+	
+	bool isTiled() const { return tilesX() > 1 || tilesY() > 1; }
+	
+	/**
+	 @return size of a sample in bytes.
+	 */
+	static size_t sampleSize(RawPixelType type);
+	
+	/**
+	 @return maximal sample value of the type, see PixelTraits, i.e. 1 for
+			float.
+	 */
+	static double sampleMax(RawPixelType type);
+	
+	/**
+	 @return size of a tile in bytes.
+	 */
+	size_t tileBytes() const
+	{
+		return (size_t)header.tile_width * header.tile_height * header.channels * sampleSize(pixelType());
+	}
+	
+	/**
+	 @return first sample of the tile (tx, ty).
+	 */
+	template <typename T>
+	T * tileData(int tx, int ty) const
+	{
+		checkType<T>();
+		assert(tx >= 0 && ty >= 0 && tx < tilesX() && ty < tilesY());
+		return (T *)(map + header.data_offset + ((size_t)ty * tilesX() + tx) * tileBytes());
+	}
+	
+	/**
+	 @brief	Zero copy view of the tile (tx, ty), cropped to the image at
+			the right and bottom border. The view has the layout of the file,
+			so Layout and Channels have to match it.
+	 */
+	template <typename T, int Channels, typename Layout>
+	ImageView<T, Channels, Layout> tile(int tx, int ty) const
+	{
+		if ((int)header.channels != Channels ||
+			ImageView<T, Channels, Layout>::isPlanar() != (layout() == RAW_PLANAR))
+			throw std::runtime_error(path + ": the view does not match the channels or the layout of the image.");
+		ImageView<T, Channels, Layout> full(tileData<T>(tx, ty), header.tile_width, header.tile_height);
+		return full.roi(0, 0, std::min(header.tile_width, header.width - tx * header.tile_width),
+						std::min(header.tile_height, header.height - ty * header.tile_height));
+	}
+	
+	/**
+	 @brief	Zero copy view of channel c of the tile (tx, ty) for any layout.
+	 */
+	template <typename T>
+	ImageView<T> tileChannel(int tx, int ty, int c) const
+	{
+		assert(c >= 0 && c < (int)header.channels);
+		T *data = tileData<T>(tx, ty);
+		size_t tw = header.tile_width;
+		size_t th = header.tile_height;
+		size_t channels = header.channels;
+		ImageView<T> full = layout() == RAW_PLANAR ?
+			ImageView<T>(data + c * tw * th, tw, th, tw, 1, 0) :
+			ImageView<T>(data + c, tw, th, tw * channels, channels, 0);
+		return full.roi(0, 0, std::min(header.tile_width, header.width - tx * header.tile_width),
+						std::min(header.tile_height, header.height - ty * header.tile_height));
+	}
+	
+	/**
+	 @brief	Zero copy view of the whole untiled image.
+	 */
+	template <typename T, int Channels, typename Layout>
+	ImageView<T, Channels, Layout> view() const
+	{
+		if (isTiled())
+			throw std::runtime_error(path + " is tiled, use tile().");
+		return tile<T, Channels, Layout>(0, 0);
+	}
+	
+	/**
+	 @brief	Shares the mapped samples of untiled planar image with img,
+			which stays valid while the image is mapped.
+	 */
+	template <typename T>
+	void sharedCImg(cimg_library::CImg<T> &img) const
+	{
+		if (isTiled() || layout() != RAW_PLANAR)
+			throw std::runtime_error(path + ": only untiled planar images can be shared as CImg.");
+		img.assign(tileData<T>(0, 0), header.width, header.height, 1, header.channels, true);
+	}
+	
+	/**
+	 @brief	Copies the samples of all tiles into planar CImg image. The
+			samples are converted to T when it differs from the pixel type
+			of the file, their range is kept, e.g. 8 bit image read as float
+			is in <0, 255>.
+	 */
+	template <typename T>
+	void toCImg(cimg_library::CImg<T> &img) const
+	{
+		switch (pixelType())
+		{
+			case RAW_U8:
+				copyTiles<unsigned char>(img);
+				break;
+			case RAW_U16:
+				copyTiles<unsigned short>(img);
+				break;
+			default:
+				copyTiles<float>(img);
+				break;
+		}
+	}
+	
+	/**
+	 @brief	Writes the planar CImg image into new raw image file.
+	 @param tile_width	width of the tiles, 0 for untiled image.
+	 @param tile_height	height of the tiles, 0 for untiled image.
+	 */
+	template <typename T>
+	static void write(const std::string &path, cimg_library::CImg<T> &img, RawLayout layout = RAW_PLANAR,
+					  int tile_width = 0, int tile_height = 0)
+	{
+		RawImage raw;
+		raw.create(path, img.width(), img.height() * img.depth(), img.spectrum(),
+				   RawPixelTypeOf<T>::value, layout, tile_width, tile_height);
+		for (int c = 0; c < img.spectrum(); ++c)
+		{
+			ImageView<T> src = ImageView<T>::fromCImg(img, c);
+			for (int ty = 0; ty < raw.tilesY(); ++ty)
+			{
+				for (int tx = 0; tx < raw.tilesX(); ++tx)
+				{
+					ImageView<T> dst = raw.tileChannel<T>(tx, ty, c);
+					LayoutConversion::convert(src.roi(tx * raw.tileWidth(), ty * raw.tileHeight(),
+													  dst.width, dst.height), dst);
+				}
+			}
+		}
+	}
+	
+private:
+	
+	RawImage(const RawImage &);
+	RawImage &operator=(const RawImage &);
+	
+	template <typename T>
+	void checkType() const
+	{
+		if (pixelType() != RawPixelTypeOf<T>::value)
+			throw std::runtime_error(path + ": the requested pixel type does not match the image.");
+	}
+	
+	/**
+	 Copies the tiles of samples S into img of type T.
+	 */
+	template <typename S, typename T>
+	void copyTiles(cimg_library::CImg<T> &img) const
+	{
+		img.assign(header.width, header.height, 1, header.channels);
+		for (int c = 0; c < (int)header.channels; ++c)
+		{
+			ImageView<T> dst = ImageView<T>::fromCImg(img, c);
+			for (int ty = 0; ty < tilesY(); ++ty)
+			{
+				for (int tx = 0; tx < tilesX(); ++tx)
+				{
+					ImageView<S> src = tileChannel<S>(tx, ty, c);
+					copyTile(src, dst.roi(tx * header.tile_width, ty * header.tile_height,
+										  src.width, src.height));
+				}
+			}
+		}
+	}
+	
+	template <typename T>
+	static void copyTile(const ImageView<T> &src, const ImageView<T> &dst)
+	{
+		LayoutConversion::convert(src, dst);
+	}
+	
+	template <typename S, typename T>
+	static void copyTile(const ImageView<S> &src, const ImageView<T> &dst)
+	{
+		for (unsigned int y = 0; y < src.height; ++y)
+		{
+			for (unsigned int x = 0; x < src.width; ++x)
+			{
+				dst(x, y) = (T)src(x, y);
+			}
+		}
+	}
+	
+	void mapFile(bool writable);
+	
+	/**
+	 Bytes of all tiles computed in 64 bits, false if the product
+	 overflows, so that a corrupted header can not pass the size check.
+	 */
+	bool dataSize(uint64_t &bytes) const;
+	
+	std::string path;
+	RawHeader header;
+	int fd;
+	bool writable;
+	unsigned char *map;
+	size_t map_size;
+};
+
+#endif /* defined(__kimproc__RawImage__) */
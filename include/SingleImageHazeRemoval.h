@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <algorithm>
 #include <climits>
+#include <limits>
 #include <string>
 #include <cmath>
 #include <vector>
@@ -24,6 +25,10 @@
 #include <Eigen/SparseLU>
 
 #include "CImg.h"
+#include "BufferPool.h"
+#include "LayoutConversion.h"
+#include "PixelTraits.h"
+#include "HalfFloat.h"
 
 #define PATCH_SIZE 15
 #define OMEGA 0.95
@@ -36,40 +41,55 @@ using namespace cimg_library;
 /**
  @brief SingleImageHazeRemoval implements haze removal method from 
  Single Image Haze Removal Using Dark Channel Prior, by He, Sun, Tang, CVPR 09.
+ The pixel type T is unsigned char, unsigned short or float, the output
+ images have the same type and use its whole range, see PixelTraits.
  */
+template <typename T>
 class SingleImageHazeRemoval
 {
 	
 public:
+	/**
+	 the kernels read all three channels of each pixel, interleaved pixels
+	 keep them in one cache line
+	 */
+	typedef Interleaved PreferredLayout;
+	
 	/**
 	 @param image			the CImg image to be dehazed
 	 @param _output_name	name of the output file
+	 @param half_precision	store the intermediate planes of the transmission
+							estimate in half precision
 	 */
-	SingleImageHazeRemoval(CImg<unsigned char> &image, std::string _output_name);
+	SingleImageHazeRemoval(CImg<T> &image, std::string _output_name,
+						   bool half_precision = false);
 	
 	/**
 	 Entry method that runs dehazing process
+	 @return the scene radiance, i.e. the dehazed image
 	 */
-	void dehaze();
+	CImg<T> dehaze();
 	
 private:
 	
-	CImg<unsigned char> &input_image;
+	CImg<T> &input_image;
+	LayeredImage<T, 3> layered;
 	std::string output_name;
+	bool half_precision;
 	
-	CImg<unsigned char> dark_channel;
-	CImg<unsigned char> transEst;
+	CImg<T> dark_channel;
+	CImg<T> transEst;
 	
 	/**
 	 Calculation of dark channel prior on input_image
 	 */
-	template <typename T>
-	void darkChannel(CImg<T> &_input_image, CImg<T> &_dark_channel)
+	template <typename P, typename Layout>
+	void darkChannel(const ImageView<P, 3, Layout> &_input_image, CImg<P> &_dark_channel)
 	{
-		int w = _input_image.width();
-		int h = _input_image.height();
-		T p_min;
-		T c_min;
+		int w = _input_image.width;
+		int h = _input_image.height;
+		P p_min;
+		P c_min;
 		
 		//clock_t begin = clock();
 		
@@ -77,14 +97,14 @@ private:
 		{
 			for (int x = 0; x < w; ++x)
 			{
-				p_min = 255;
+				p_min = std::numeric_limits<P>::max();
 				for (int py = y; py < std::min(y + PATCH_SIZE, h); ++py)
 				{
 					for (int px = x; px < std::min(x + PATCH_SIZE, w); ++px)
 					{
-						c_min = std::min(std::min(_input_image(px, py, 0, 0),
-												  _input_image(px, py, 0, 1)),
-										 _input_image(px, py, 0, 2));
+						c_min = std::min(std::min(_input_image(px, py, 0),
+												  _input_image(px, py, 1)),
+										 _input_image(px, py, 2));
 						
 						p_min = std::min(p_min, c_min);
 						if (p_min == 0)
@@ -106,15 +126,28 @@ private:
 	/**
 	 Calculation of atmospheric light from darkChannel
 	 */
-	Eigen::Vector3i atmosphericLight();
+	Eigen::Vector3d atmosphericLight();
 	
-	void transmissionEstimate(Eigen::Vector3i atmLight);
+	void transmissionEstimate(Eigen::Vector3d atmLight);
 	
-	void getRadiance(Eigen::Vector3i atmLight, CImg<unsigned char> &trans, CImg<unsigned char> &out_rad);
+	/**
+	 Transmission estimate with the intermediate planes stored as S, float
+	 or Half.
+	 */
+	template <typename S>
+	void estimateTransmission(Eigen::Vector3d atmLight);
 	
-	CImg<double> depthMap(CImg<unsigned char> &transmission);
+	void getRadiance(Eigen::Vector3d atmLight, CImg<T> &trans, CImg<T> &out_rad);
+	
+	CImg<double> depthMap(CImg<T> &transmission);
+	
+	/**
+	 Saves the intermediate image to output_name + suffix, float images
+	 are scaled from <0, 1> to 8 bits.
+	 */
+	void save(const CImg<T> &img, const std::string &suffix);
 	
-	std::vector<int> sort_indices(const unsigned char *v, int size) {
+	std::vector<int> sort_indices(const T *v, int size) {
 		
 		// initialize original index locations
 		std::vector<int> idx(size);
@@ -140,17 +173,17 @@ private:
 	 @return		columnwise matrix of pixels from given window, each column
 					of the matrix is one pixel (r, g, b) vector.
 	 */
-	Eigen::MatrixXd windowFlatMatrix(CImg<unsigned char> &im, int window, int cx, int cy);
+	Eigen::MatrixXd windowFlatMatrix(CImg<T> &im, int window, int cx, int cy);
 	
-	Eigen::MatrixXd vecFromTransmission(CImg<unsigned char> &trans);
+	Eigen::MatrixXd vecFromTransmission(CImg<T> &trans);
 	
-	Eigen::MatrixXd rgbVec(CImg<unsigned char> &im, int x, int y);
+	Eigen::MatrixXd rgbVec(CImg<T> &im, int x, int y);
 	
-	CImg<unsigned char> vecToImg(Eigen::MatrixXd &vec, int w, int h);
+	CImg<T> vecToImg(Eigen::MatrixXd &vec, int w, int h);
 	
 	Eigen::SparseMatrix<double> sparseDiagonal(int size, double val);
 	
-	CImg<unsigned char> matte();
+	CImg<T> matte();
 
 };
 
@@ -0,0 +1,539 @@
+//
+//  TiledImage.h
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#ifndef __kimproc__TiledImage__
+#define __kimproc__TiledImage__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <cstring>
+
+#ifdef cimg_use_tiff
+#include "tiffio.h"
+#endif
+
+#include "CImg.h"
+#include "ImageView.h"
+#include "LayoutConversion.h"
+#include "RawImage.h"
+
+// default memory budget of the tile cache, in bytes
+#define TILE_CACHE_BUDGET (256 * 1024 * 1024)
+
+/**
+ @brief	Source of the tiles of TiledImage. The tiles are passed planar,
+		every tile buffer has tileWidth() x tileHeight() x channels()
+		samples, the tiles at the right and bottom border are cropped to
+		the image, the rest of their buffer is not used. The calls are
+		serialized by TiledImage.
+ */
+template <typename T>
+class TileSource
+{
+public:
+	virtual ~TileSource(){}
+	
+	virtual int width() const = 0;
+	
+	virtual int height() const = 0;
+	
+	virtual int channels() const = 0;
+	
+	virtual int tileWidth() const = 0;
+	
+	virtual int tileHeight() const = 0;
+	
+	/**
+	 @return true if writeTile() stores the tiles.
+	 */
+	virtual bool writable() const { return false; }
+	
+	virtual void readTile(int tx, int ty, T * tile) = 0;
+	
+	virtual void writeTile(int tx, int ty, const T * tile)
+	{
+		throw std::runtime_error("TileSource::writeTile(): the source is read only.");
+	}
+	
+	int tilesX() const { return (width() + tileWidth() - 1) / tileWidth(); }
+	
+	int tilesY() const { return (height() + tileHeight() - 1) / tileHeight(); }
+	
+	/**
+	 @return width of the tile tx, smaller than tileWidth() at the border.
+	 */
+	int tileCols(int tx) const { return std::min(tileWidth(), width() - tx * tileWidth()); }
+	
+	int tileRows(int ty) const { return std::min(tileHeight(), height() - ty * tileHeight()); }
+};
+
+/**
+ @brief	Tiles of a raw image (see RawImage), read from and written to its
+		mapping. The tiles are the tiles of the file, untiled image is a
+		single tile. Writes go to the file only if the image was opened
+		writable.
+ */
+template <typename T>
+class RawTileSource : public TileSource<T>
+{
+public:
+	RawTileSource(RawImage &raw)
+	:raw(raw)
+	{
+		if (raw.pixelType() != RawPixelTypeOf<T>::value)
+			throw std::runtime_error("RawTileSource: the pixel type does not match the image.");
+	}
+	
+	int width() const { return raw.width(); }
+	
+	int height() const { return raw.height(); }
+	
+	int channels() const { return raw.channels(); }
+	
+	int tileWidth() const { return raw.tileWidth(); }
+	
+	int tileHeight() const { return raw.tileHeight(); }
+	
+	bool writable() const { return raw.isWritable(); }
+	
+	void readTile(int tx, int ty, T * tile)
+	{
+		for (int c = 0; c < raw.channels(); ++c)
+		{
+			ImageView<T> src = raw.tileChannel<T>(tx, ty, c);
+			LayoutConversion::convert(src, plane(tile, c, src));
+		}
+	}
+	
+	void writeTile(int tx, int ty, const T * tile)
+	{
+		if (!writable())
+			TileSource<T>::writeTile(tx, ty, tile);
+		for (int c = 0; c < raw.channels(); ++c)
+		{
+			ImageView<T> dst = raw.tileChannel<T>(tx, ty, c);
+			LayoutConversion::convert(plane(const_cast<T *>(tile), c, dst), dst);
+		}
+	}
+	
+private:
+	
+	/**
+	 View of channel c of the tile buffer cropped as the view of the file.
+	 */
+	ImageView<T> plane(T * tile, int c, const ImageView<T> &crop) const
+	{
+		size_t tw = raw.tileWidth();
+		size_t th = raw.tileHeight();
+		return ImageView<T>(tile + c * tw * th, crop.width, crop.height, tw, 1, tw * th);
+	}
+	
+	RawImage &raw;
+};
+
+#ifdef cimg_use_tiff
+
+/**
+ @brief	Tiles or strips of a TIFF file read through libtiff. Tiled TIFFs
+		are read by their tiles, striped TIFFs by their strips, i.e. tiles
+		of the image width. The samples have to be of type T, both
+		contiguous and separate planar configurations are supported.
+		Read only, the strips may be compressed.
+ */
+template <typename T>
+class TiffTileSource : public TileSource<T>
+{
+public:
+	TiffTileSource(const std::string &path)
+	:path(path), tif(TIFFOpen(path.c_str(), "r"))
+	{
+		if (!tif)
+			throw std::runtime_error("Unable to open " + path + " for reading.");
+		
+		uint32_t width = 0, height = 0;
+		uint16_t spp = 1, bps = 8, planar = PLANARCONFIG_CONTIG;
+		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bps);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+		if (bps != sizeof(T) * 8)
+		{
+			TIFFClose(tif);
+			throw std::runtime_error(path + ": the sample size does not match the pixel type.");
+		}
+		w = width;
+		h = height;
+		c = spp;
+		separate = planar == PLANARCONFIG_SEPARATE;
+		tiled = TIFFIsTiled(tif);
+		if (tiled)
+		{
+			uint32_t tile_width = 0, tile_height = 0;
+			TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tile_width);
+			TIFFGetField(tif, TIFFTAG_TILELENGTH, &tile_height);
+			tw = tile_width;
+			th = tile_height;
+		}
+		else
+		{
+			uint32_t rows = 0;
+			TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rows);
+			tw = w;
+			th = std::min(rows, height);
+		}
+		chunk.resize(tiled ? TIFFTileSize(tif) : TIFFStripSize(tif));
+	}
+	
+	~TiffTileSource()
+	{
+		TIFFClose(tif);
+	}
+	
+	/**
+	 @return true if the file starts with the TIFF byte order mark.
+	 */
+	static bool isTiff(const std::string &path)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f)
+			return false;
+		char magic[4];
+		bool tiff = fread(magic, 1, 4, f) == 4 &&
+			(memcmp(magic, "II*\0", 4) == 0 || memcmp(magic, "MM\0*", 4) == 0);
+		fclose(f);
+		return tiff;
+	}
+	
+	int width() const { return w; }
+	
+	int height() const { return h; }
+	
+	int channels() const { return c; }
+	
+	int tileWidth() const { return tw; }
+	
+	int tileHeight() const { return th; }
+	
+	void readTile(int tx, int ty, T * tile)
+	{
+		int cols = this->tileCols(tx);
+		int rows = this->tileRows(ty);
+		size_t plane = (size_t)tw * th;
+		for (int s = 0; s < (separate ? c : 1); ++s)
+		{
+			readChunk(tx, ty, s);
+			const T *src = (const T *)chunk.data();
+			//tiles are stored padded to the tile size, strips are not
+			for (int y = 0; y < rows; ++y)
+			{
+				for (int ch = 0; ch < (separate ? 1 : c); ++ch)
+				{
+					T *dst = tile + (s + ch) * plane + (size_t)y * tw;
+					if (separate)
+					{
+						std::copy(src + (size_t)y * tw, src + (size_t)y * tw + cols, dst);
+					}
+					else
+					{
+						const T *row = src + (size_t)y * tw * c + ch;
+						for (int x = 0; x < cols; ++x)
+							dst[x] = row[(size_t)x * c];
+					}
+				}
+			}
+		}
+	}
+	
+private:
+	
+	TiffTileSource(const TiffTileSource &);
+	TiffTileSource &operator=(const TiffTileSource &);
+	
+	/**
+	 Decodes tile or strip (tx, ty) of sample plane s into chunk.
+	 */
+	void readChunk(int tx, int ty, int s)
+	{
+		tsize_t read = tiled ?
+			TIFFReadEncodedTile(tif, TIFFComputeTile(tif, tx * tw, ty * th, 0, s), chunk.data(), -1) :
+			TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, ty * th, s), chunk.data(), -1);
+		if (read < 0)
+			throw std::runtime_error(path + ": unable to decode the tile.");
+	}
+	
+	std::string path;
+	TIFF *tif;
+	int w;
+	int h;
+	int c;
+	int tw;
+	int th;
+	bool separate;
+	bool tiled;
+	std::vector<unsigned char> chunk;
+};
+
+#endif /* cimg_use_tiff */
+
+/**
+ @brief	Image of a TileSource whose tiles are loaded on demand and kept in
+		a cache of limited size, so that images larger than memory can be
+		processed by regions. When the budget is exceeded, the least
+		recently used tile is evicted, modified (dirty) tiles are written
+		back to the source first. The kernels request regions extended by
+		a halo, samples of the halo outside of the image replicate the
+		border. Thread safe, the regions are copied out of the cache.
+ */
+template <typename T>
+class TiledImage
+{
+public:
+	
+	struct Stats
+	{
+		/** tile requests served by the cache */
+		size_t hits;
+		/** tiles loaded from the source */
+		size_t misses;
+		/** tiles evicted to stay in the budget */
+		size_t evictions;
+		/** dirty tiles written to the source */
+		size_t write_backs;
+		/** bytes of the cached tiles */
+		size_t cached_bytes;
+	};
+	
+	/**
+	 @param budget	memory for the cached tiles in bytes, at least one tile
+					is always cached.
+	 */
+	TiledImage(TileSource<T> &source, size_t budget = TILE_CACHE_BUDGET)
+	:source(source), budget(budget),
+	tile_size((size_t)source.tileWidth() * source.tileHeight() * source.channels())
+	{
+		counters.hits = 0;
+		counters.misses = 0;
+		counters.evictions = 0;
+		counters.write_backs = 0;
+		counters.cached_bytes = 0;
+	}
+	
+	/**
+	 @brief	Writes the dirty tiles back to the source.
+	 */
+	~TiledImage()
+	{
+		flush();
+	}
+	
+	int width() const { return source.width(); }
+	
+	int height() const { return source.height(); }
+	
+	int channels() const { return source.channels(); }
+	
+	/**
+	 @brief	Copies the region of w x h pixels at (x, y), extended by halo
+			pixels on each side, into planar image of
+			(w + 2 * halo) x (h + 2 * halo) pixels. The region has to be
+			inside the image, the halo may reach outside, where the border
+			pixels are repeated.
+	 */
+	void readRegion(int x, int y, int w, int h, int halo, cimg_library::CImg<T> &region)
+	{
+		assert(w > 0 && h > 0 && halo >= 0);
+		assert(x >= 0 && y >= 0 && x + w <= width() && y + h <= height());
+		int rw = w + 2 * halo;
+		int rh = h + 2 * halo;
+		region.assign(rw, rh, 1, channels());
+		
+		//part of the region inside of the image and its offset in region
+		int x0 = std::max(0, x - halo);
+		int y0 = std::max(0, y - halo);
+		int x1 = std::min(width(), x + w + halo);
+		int y1 = std::min(height(), y + h + halo);
+		int ox = x0 - (x - halo);
+		int oy = y0 - (y - halo);
+		transfer(x0, y0, x1, y1, region, x0 - ox, y0 - oy, false);
+		
+		//repeat the border into the halo outside of the image
+		for (int c = 0; c < channels(); ++c)
+		{
+			for (int ry = oy; ry < oy + y1 - y0; ++ry)
+			{
+				T *row = region.data(0, ry, 0, c);
+				std::fill(row, row + ox, row[ox]);
+				std::fill(row + ox + x1 - x0, row + rw, row[ox + x1 - x0 - 1]);
+			}
+			for (int ry = 0; ry < rh; ++ry)
+			{
+				if (ry >= oy && ry < oy + y1 - y0)
+					continue;
+				int sy = ry < oy ? oy : oy + y1 - y0 - 1;
+				std::copy(region.data(0, sy, 0, c), region.data(0, sy, 0, c) + rw, region.data(0, ry, 0, c));
+			}
+		}
+	}
+	
+	/**
+	 @brief	Writes region read by readRegion() with the same halo back,
+			without the halo, to the image at (x, y). The modified tiles
+			are written to the source when evicted or flushed.
+	 */
+	void writeRegion(int x, int y, const cimg_library::CImg<T> &region, int halo = 0)
+	{
+		if (!source.writable())
+			throw std::runtime_error("TiledImage::writeRegion(): the source is read only.");
+		int w = region.width() - 2 * halo;
+		int h = region.height() - 2 * halo;
+		assert(w > 0 && h > 0 && region.spectrum() == channels());
+		assert(x >= 0 && y >= 0 && x + w <= width() && y + h <= height());
+		transfer(x, y, x + w, y + h, const_cast<cimg_library::CImg<T> &>(region), x - halo, y - halo, true);
+	}
+	
+	/**
+	 @brief	Writes the dirty tiles back to the source, they stay cached.
+	 */
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (typename std::map<int, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+		{
+			writeBack(it->first, it->second);
+		}
+	}
+	
+	Stats stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return counters;
+	}
+	
+private:
+	
+	struct Tile
+	{
+		std::vector<T> data;
+		bool dirty;
+		/** position in the lru list */
+		std::list<int>::iterator used;
+	};
+	
+	TiledImage(const TiledImage &);
+	TiledImage &operator=(const TiledImage &);
+	
+	/**
+	 Copies the rectangle <x0, x1) x <y0, y1) of the image from (store ==
+	 false) or to the tiles, (rx, ry) is the image position of the first
+	 pixel of region.
+	 */
+	void transfer(int x0, int y0, int x1, int y1, cimg_library::CImg<T> &region, int rx, int ry,
+				  bool store)
+	{
+		int tw = source.tileWidth();
+		int th = source.tileHeight();
+		size_t plane = (size_t)tw * th;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int ty = y0 / th; ty <= (y1 - 1) / th; ++ty)
+		{
+			for (int tx = x0 / tw; tx <= (x1 - 1) / tw; ++tx)
+			{
+				Tile &tile = fetch(tx, ty);
+				int bx0 = std::max(x0, tx * tw);
+				int by0 = std::max(y0, ty * th);
+				int bx1 = std::min(x1, (tx + 1) * tw);
+				int by1 = std::min(y1, (ty + 1) * th);
+				for (int c = 0; c < channels(); ++c)
+				{
+					for (int y = by0; y < by1; ++y)
+					{
+						T *t = tile.data.data() + c * plane + (size_t)(y - ty * th) * tw + (bx0 - tx * tw);
+						T *r = region.data(bx0 - rx, y - ry, 0, c);
+						if (store)
+							std::copy(r, r + bx1 - bx0, t);
+						else
+							std::copy(t, t + bx1 - bx0, r);
+					}
+				}
+				tile.dirty |= store;
+			}
+		}
+	}
+	
+	/**
+	 Cached tile (tx, ty), loaded from the source if needed. Has to be
+	 called with the mutex locked.
+	 */
+	Tile & fetch(int tx, int ty)
+	{
+		int key = ty * source.tilesX() + tx;
+		typename std::map<int, Tile>::iterator it = tiles.find(key);
+		if (it != tiles.end())
+		{
+			++counters.hits;
+			lru.splice(lru.begin(), lru, it->second.used);
+			return it->second;
+		}
+		
+		++counters.misses;
+		while (!tiles.empty() && (tiles.size() + 1) * tile_size * sizeof(T) > budget)
+		{
+			evict();
+		}
+		Tile &tile = tiles[key];
+		tile.data.resize(tile_size);
+		tile.dirty = false;
+		source.readTile(tx, ty, tile.data.data());
+		lru.push_front(key);
+		tile.used = lru.begin();
+		counters.cached_bytes += tile_size * sizeof(T);
+		return tile;
+	}
+	
+	/**
+	 Evicts the least recently used tile.
+	 */
+	void evict()
+	{
+		int key = lru.back();
+		typename std::map<int, Tile>::iterator it = tiles.find(key);
+		writeBack(key, it->second);
+		lru.pop_back();
+		tiles.erase(it);
+		++counters.evictions;
+		counters.cached_bytes -= tile_size * sizeof(T);
+	}
+	
+	void writeBack(int key, Tile &tile)
+	{
+		if (!tile.dirty)
+			return;
+		source.writeTile(key % source.tilesX(), key / source.tilesX(), tile.data.data());
+		tile.dirty = false;
+		++counters.write_backs;
+	}
+	
+	TileSource<T> &source;
+	size_t budget;
+	/** samples of a tile */
+	size_t tile_size;
+	mutable std::mutex mutex;
+	std::map<int, Tile> tiles;
+	/** keys of the cached tiles, most recently used first */
+	std::list<int> lru;
+	Stats counters;
+};
+
+#endif /* defined(__kimproc__TiledImage__) */
@@ -236,6 +236,12 @@ private:
         return qArguments;
     }
 
+public:
+
+    /**
+     * @brief printUsage    Prints the generated help, e.g. when a parameter
+     *                      value is not valid.
+     */
     void printUsage()
     {
         if (printUsageFlag)
@@ -0,0 +1,213 @@
+//
+//  BriefDescriptor.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "BriefDescriptor.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static inline int popcount64(uint64_t v)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+const std::vector<int> &BriefExtractor::pattern()
+{
+	static const std::vector<int> pairs = []()
+	{
+		std::vector<int> p(4 * BRIEF_BITS);
+		int half = BRIEF_PATCH_SIZE / 2;
+		double sigma = BRIEF_PATCH_SIZE / 5.0;
+		uint32_t state = 0x9e3779b9u;
+		//xorshift32, uniform in (0, 1)
+		auto uniform = [&]()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state + 0.5) / 4294967296.0;
+		};
+		for (size_t i = 0; i < p.size(); i += 2)
+		{
+			//Box-Muller, clipped to the patch
+			double r = sigma * std::sqrt(-2.0 * std::log(uniform()));
+			double a = 2.0 * M_PI * uniform();
+			p[i] = std::min(std::max((int)round(r * std::cos(a)), -half), half);
+			p[i + 1] = std::min(std::max((int)round(r * std::sin(a)), -half), half);
+		}
+		return p;
+	}();
+	return pairs;
+}
+
+float BriefExtractor::orientation(const float * smooth, int width, int height, int x, int y)
+{
+	int radius = BRIEF_PATCH_SIZE / 2;
+	float m01 = 0;
+	float m10 = 0;
+	for (int v = -radius; v <= radius; ++v)
+	{
+		int yy = std::min(std::max(y + v, 0), height - 1);
+		const float *row = smooth + (size_t)yy * width;
+		int span = (int)std::sqrt((float)(radius * radius - v * v));
+		for (int u = -span; u <= span; ++u)
+		{
+			float I = row[std::min(std::max(x + u, 0), width - 1)];
+			m10 += u * I;
+			m01 += v * I;
+		}
+	}
+	return std::atan2(m01, m10);
+}
+
+BriefDescriptor BriefExtractor::describe(const float * smooth, int width, int height,
+										 float fx, float fy, bool oriented)
+{
+	const std::vector<int> &p = pattern();
+	int x = (int)round(fx);
+	int y = (int)round(fy);
+	float c = 1;
+	float s = 0;
+	if (oriented)
+	{
+		float angle = orientation(smooth, width, height, x, y);
+		c = std::cos(angle);
+		s = std::sin(angle);
+	}
+	
+	auto sample = [&](int u, int v)
+	{
+		if (oriented)
+		{
+			int ru = (int)round(c * u - s * v);
+			int rv = (int)round(s * u + c * v);
+			u = ru;
+			v = rv;
+		}
+		int xx = std::min(std::max(x + u, 0), width - 1);
+		int yy = std::min(std::max(y + v, 0), height - 1);
+		return smooth[(size_t)yy * width + xx];
+	};
+	
+	BriefDescriptor d;
+	memset(d.bits, 0, sizeof(d.bits));
+	for (int i = 0; i < BRIEF_BITS; ++i)
+	{
+		const int *t = &p[4 * i];
+		if (sample(t[0], t[1]) < sample(t[2], t[3]))
+		{
+			d.bits[i / 64] |= (uint64_t)1 << (i % 64);
+		}
+	}
+	return d;
+}
+
+std::vector<BriefDescriptor> BriefExtractor::compute(const HarrisLaplaceDetector &pyramid,
+													 const std::vector<Keypoint> &keypoints,
+													 bool oriented)
+{
+	if (pyramid.levelCount() == 0)
+		throw std::runtime_error("BriefExtractor: the pyramid was not built, call detect() first.");
+	
+	std::vector<BriefDescriptor> descriptors(keypoints.size());
+	Parallel::forRange(0, (int)keypoints.size(), [&](int from, int to)
+	{
+		for (int i = from; i < to; ++i)
+		{
+			const Keypoint &kp = keypoints[i];
+			int l = (int)round(std::log2(std::max(kp.scale, 1.0f)));
+			l = std::min(l, pyramid.levelCount() - 1);
+			float step = (float)(1 << l);
+			descriptors[i] = describe(pyramid.smoothed(l), pyramid.levelWidth(l),
+									  pyramid.levelHeight(l), kp.x / step, kp.y / step,
+									  oriented);
+		}
+	}, 256);
+	return descriptors;
+}
+
+int BriefExtractor::hamming(const BriefDescriptor &a, const BriefDescriptor &b)
+{
+	int distance = 0;
+	for (int i = 0; i < BRIEF_BITS / 64; ++i)
+	{
+		distance += popcount64(a.bits[i] ^ b.bits[i]);
+	}
+	return distance;
+}
+
+void BriefExtractor::nearest(const std::vector<BriefDescriptor> &query,
+							 const std::vector<BriefDescriptor> &train,
+							 std::vector<int> &index, std::vector<int> &distance)
+{
+	index.assign(query.size(), -1);
+	distance.assign(query.size(), BRIEF_BITS + 1);
+	Parallel::forRange(0, (int)query.size(), [&](int from, int to)
+	{
+		for (int i = from; i < to; ++i)
+		{
+			for (size_t j = 0; j < train.size(); ++j)
+			{
+				int d = hamming(query[i], train[j]);
+				if (d < distance[i])
+				{
+					distance[i] = d;
+					index[i] = (int)j;
+				}
+			}
+		}
+	}, 64);
+}
+
+std::vector<DescriptorMatch> BriefExtractor::match(const std::vector<BriefDescriptor> &query,
+												   const std::vector<BriefDescriptor> &train,
+												   int max_distance, bool cross_check)
+{
+	std::vector<int> q_index, q_distance;
+	nearest(query, train, q_index, q_distance);
+	std::vector<int> t_index, t_distance;
+	if (cross_check)
+		nearest(train, query, t_index, t_distance);
+	
+	std::vector<DescriptorMatch> matches;
+	for (size_t i = 0; i < query.size(); ++i)
+	{
+		int j = q_index[i];
+		if (j < 0 || q_distance[i] > max_distance)
+			continue;
+		if (cross_check && t_index[j] != (int)i)
+			continue;
+		matches.push_back(DescriptorMatch((int)i, j, q_distance[i]));
+	}
+	return matches;
+}
+
+void BriefExtractor::saveMatches(const std::string &path,
+								 const std::vector<Keypoint> &query,
+								 const std::vector<Keypoint> &train,
+								 const std::vector<DescriptorMatch> &matches)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (f == NULL)
+		throw std::runtime_error("Unable to open " + path + " for writing.");
+	fprintf(f, "x1,y1,x2,y2,distance\n");
+	for (size_t i = 0; i < matches.size(); ++i)
+	{
+		const Keypoint &a = query[matches[i].query];
+		const Keypoint &b = train[matches[i].train];
+		fprintf(f, "%g,%g,%g,%g,%d\n", a.x, a.y, b.x, b.y, matches[i].distance);
+	}
+	fclose(f);
+}
@@ -0,0 +1,140 @@
+//
+//  BufferPool.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "BufferPool.h"
+
+#include <new>
+
+static void * alignedAlloc(size_t bytes)
+{
+	void *block = NULL;
+#ifdef _WIN32
+	block = _aligned_malloc(bytes, BUFFER_ALIGNMENT);
+#else
+	if (posix_memalign(&block, BUFFER_ALIGNMENT, bytes) != 0)
+		block = NULL;
+#endif
+	if (!block)
+		throw std::bad_alloc();
+	return block;
+}
+
+static void alignedFree(void * block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+BufferPool::BufferPool(size_t limit)
+:limit(limit)
+{
+	counters.hits = 0;
+	counters.misses = 0;
+	counters.cached_bytes = 0;
+	counters.used_bytes = 0;
+	counters.evictions = 0;
+}
+
+BufferPool::~BufferPool()
+{
+	clear();
+}
+
+BufferPool &BufferPool::global()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+void * BufferPool::acquire(size_t bytes)
+{
+	bytes = alignedSize(std::max(bytes, (size_t)1));
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::multimap<size_t, std::list<Block>::iterator>::iterator it = blocks.find(bytes);
+		counters.used_bytes += bytes;
+		if (it != blocks.end())
+		{
+			void *block = it->second->ptr;
+			released.erase(it->second);
+			blocks.erase(it);
+			++counters.hits;
+			counters.cached_bytes -= bytes;
+			return block;
+		}
+		++counters.misses;
+	}
+	return alignedAlloc(bytes);
+}
+
+void BufferPool::release(void * block, size_t bytes)
+{
+	if (!block)
+		return;
+	bytes = alignedSize(std::max(bytes, (size_t)1));
+	std::lock_guard<std::mutex> lock(mutex);
+	Block released_block;
+	released_block.ptr = block;
+	released_block.bytes = bytes;
+	released.push_front(released_block);
+	blocks.insert(std::make_pair(bytes, released.begin()));
+	counters.cached_bytes += bytes;
+	counters.used_bytes -= bytes;
+	trim();
+}
+
+void BufferPool::trim()
+{
+	while (counters.cached_bytes > limit)
+	{
+		std::list<Block>::iterator oldest = --released.end();
+		std::pair<std::multimap<size_t, std::list<Block>::iterator>::iterator,
+				  std::multimap<size_t, std::list<Block>::iterator>::iterator> range =
+			blocks.equal_range(oldest->bytes);
+		for (std::multimap<size_t, std::list<Block>::iterator>::iterator it = range.first;
+			 it != range.second; ++it)
+		{
+			if (it->second == oldest)
+			{
+				blocks.erase(it);
+				break;
+			}
+		}
+		alignedFree(oldest->ptr);
+		counters.cached_bytes -= oldest->bytes;
+		++counters.evictions;
+		released.erase(oldest);
+	}
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
+
+void BufferPool::setLimit(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	limit = bytes;
+	trim();
+}
+
+void BufferPool::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::list<Block>::iterator it = released.begin(); it != released.end(); ++it)
+	{
+		alignedFree(it->ptr);
+	}
+	released.clear();
+	blocks.clear();
+	counters.cached_bytes = 0;
+}
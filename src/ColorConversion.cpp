@@ -0,0 +1,126 @@
+//
+//  ColorConversion.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "ColorConversion.h"
+
+#include <cstring>
+
+#include "Parallel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline unsigned char luma(unsigned char r, unsigned char g, unsigned char b)
+{
+	return (unsigned char)((LUMA_WEIGHT_R * r + LUMA_WEIGHT_G * g + LUMA_WEIGHT_B * b +
+							(1 << (LUMA_FRAC_BITS - 1))) >> LUMA_FRAC_BITS);
+}
+
+void ColorConversion::rgbToLuma(const unsigned char * r, const unsigned char * g,
+								const unsigned char * b, unsigned char * out, int count)
+{
+	int x = 0;
+#ifdef __SSE2__
+	//r and g interleaved as 16 bit pairs are multiplied by the weight pair
+	//and summed by pmaddwd, b is paired with 1 to add the rounding term
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w_rg = _mm_set1_epi32((LUMA_WEIGHT_G << 16) | LUMA_WEIGHT_R);
+	const __m128i w_b = _mm_set1_epi32(((1 << (LUMA_FRAC_BITS - 1)) << 16) | LUMA_WEIGHT_B);
+	const __m128i one = _mm_set1_epi16(1);
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+		__m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+		__m128i res16[2];
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i r16 = half ? _mm_unpackhi_epi8(vr, zero) : _mm_unpacklo_epi8(vr, zero);
+			__m128i g16 = half ? _mm_unpackhi_epi8(vg, zero) : _mm_unpacklo_epi8(vg, zero);
+			__m128i b16 = half ? _mm_unpackhi_epi8(vb, zero) : _mm_unpacklo_epi8(vb, zero);
+			__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), w_rg),
+									   _mm_madd_epi16(_mm_unpacklo_epi16(b16, one), w_b));
+			__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), w_rg),
+									   _mm_madd_epi16(_mm_unpackhi_epi16(b16, one), w_b));
+			res16[half] = _mm_packs_epi32(_mm_srli_epi32(lo, LUMA_FRAC_BITS),
+										  _mm_srli_epi32(hi, LUMA_FRAC_BITS));
+		}
+		_mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(res16[0], res16[1]));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		out[x] = luma(r[x], g[x], b[x]);
+	}
+}
+
+void ColorConversion::rgbToLuma(const cimg_library::CImg<unsigned char> &src,
+								cimg_library::CImg<unsigned char> &gray)
+{
+	int width = src.width();
+	int height = src.height();
+	gray.assign(width, height, src.depth(), 1);
+	if (src.spectrum() < 3)
+	{
+		memcpy(gray.data(), src.data(), (size_t)width * height * src.depth());
+		return;
+	}
+	
+	int rows = height * src.depth();
+	size_t plane = (size_t)width * rows;
+	const unsigned char *r = src.data();
+	unsigned char *out = gray.data();
+	Parallel::forRange(0, rows, [=](int from, int to)
+	{
+		size_t offset = (size_t)from * width;
+		rgbToLuma(r + offset, r + plane + offset, r + 2 * plane + offset, out + offset,
+				  (to - from) * width);
+	}, 256);
+}
+
+void ColorConversion::rgbToLuma(const cimg_library::CImg<unsigned char> &src, Image &gray)
+{
+	int width = src.width();
+	int rows = src.height() * src.depth();
+	assert(gray.width == (unsigned int)width && gray.height == (unsigned int)rows &&
+		   gray.contiguousRows());
+	size_t plane = (size_t)width * rows;
+	const unsigned char *r = src.data();
+	const unsigned char *g = src.spectrum() < 3 ? r : r + plane;
+	const unsigned char *b = src.spectrum() < 3 ? r : r + 2 * plane;
+	Image out = gray;
+	Parallel::forRange(0, rows, [=](int from, int to)
+	{
+		for (int y = from; y < to; ++y)
+		{
+			size_t offset = (size_t)y * width;
+			if (r == g)
+				memcpy(out.row(y), r + offset, width);
+			else
+				rgbToLuma(r + offset, g + offset, b + offset, out.row(y), width);
+		}
+	}, 256);
+}
+
+void ColorConversion::interleavedToLuma(const unsigned char * pixels, int channels,
+										unsigned char * out, int count)
+{
+	if (channels < 3)
+	{
+		for (int x = 0; x < count; ++x)
+		{
+			out[x] = pixels[x * channels];
+		}
+		return;
+	}
+	for (int x = 0; x < count; ++x)
+	{
+		const unsigned char *p = pixels + x * channels;
+		out[x] = luma(p[0], p[1], p[2]);
+	}
+}
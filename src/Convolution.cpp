@@ -7,6 +7,19 @@
 //
 
 #include "Convolution.h"
+#include "FFTConvolver.h"
+
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 void Convolution::convolve1D(Image &image, float * result, unsigned int kernel_size, float * kernel, int direction)
 {
@@ -19,7 +32,6 @@ void Convolution::convolve1D(Image &image, float * result, unsigned int kernel_s
 		kernel_w = 1;
 	}
 
-	unsigned int index = 0;
 	unsigned int index1 = 0;
 	unsigned char val = 0;
 	float res = 0;
@@ -35,8 +47,7 @@ void Convolution::convolve1D(Image &image, float * result, unsigned int kernel_s
 				{
 					int y_t = y - t;
 					int x_s = x - s;
-					index = (y_t >= 0 ? y_t : 0) * image.width + (x_s >= 0 ? x_s : 0);
-					val = image.data[index];
+					val = image.row(y_t >= 0 ? y_t : 0)[x_s >= 0 ? x_s : 0];
 					res += val * kernel[t * kernel_w + s];
 				}
 			}
@@ -73,7 +84,7 @@ void Convolution::convolve1D(Imagef &image, float * result, unsigned int kernel_
 					int y_t = y - t;
 					int x_s = x - s;
 					index = (y_t >= 0 ? y_t : 0) * image.width + (x_s >= 0 ? x_s : 0);
-					val = image.data[index];
+					val = image.row(y_t >= 0 ? y_t : 0)[x_s >= 0 ? x_s : 0];
 					res += val * kernel[t * kernel_w + s];
 				}
 			}
@@ -139,3 +150,358 @@ void Convolution::convolve1D(CImg<float> &image, CImg<float> &result, unsigned i
 	}
 	delete [] res;
 }
+
+void Convolution::quantizeKernel(float * kernel, unsigned int kernel_size, short * qkernel, int frac_bits)
+{
+	if (frac_bits < 0 || frac_bits > 15)
+		throw std::runtime_error("Number of fractional bits has to be in <0, 15>.");
+	
+	const double scale = (double)(1 << frac_bits);
+	for (unsigned int i = 0; i < kernel_size; ++i)
+	{
+		long q = lround(kernel[i] * scale);
+		if (q > SHRT_MAX || q < SHRT_MIN)
+			throw std::runtime_error("Kernel coefficient does not fit into \
+									 16 bit fixed point representation.");
+		qkernel[i] = (short)q;
+	}
+}
+
+void Convolution::convolve1D(Image &image, short * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction)
+{
+	convolve1DFixed<short>(image, result, kernel_size, qkernel, frac_bits, direction);
+}
+
+void Convolution::convolve1D(Image &image, unsigned char * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction)
+{
+	convolve1DFixed<unsigned char>(image, result, kernel_size, qkernel, frac_bits, direction);
+}
+
+static inline void saturate(int val, short &out)
+{
+	out = (short)(val > SHRT_MAX ? SHRT_MAX : (val < SHRT_MIN ? SHRT_MIN : val));
+}
+
+static inline void saturate(int val, unsigned char &out)
+{
+	out = (unsigned char)(val > UCHAR_MAX ? UCHAR_MAX : (val < 0 ? 0 : val));
+}
+
+#ifdef __SSE2__
+static inline void store8(__m128i lo, __m128i hi, short *out)
+{
+	_mm_storeu_si128((__m128i *)out, _mm_packs_epi32(lo, hi));
+}
+
+static inline void store8(__m128i lo, __m128i hi, unsigned char *out)
+{
+	__m128i s = _mm_packs_epi32(lo, hi);
+	_mm_storel_epi64((__m128i *)out, _mm_packus_epi16(s, s));
+}
+#endif
+
+/**
+ Computes out[i] = sum_j taps[j][i] * qkernel[j] for i in <0, count).
+ The taps are paired so that each pmaddwd does two multiply-adds per pixel
+ into 32-bit accumulators, hence no intermediate saturation happens.
+ */
+template <typename T>
+static void convolveRowFixed(const unsigned char ** taps, short * qkernel, unsigned int kernel_size, int frac_bits, int count, T * out)
+{
+	const int half = frac_bits > 0 ? 1 << (frac_bits - 1) : 0;
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vround = _mm_set1_epi32(half);
+	const __m128i vshift = _mm_cvtsi32_si128(frac_bits);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i acc_lo = vround;
+		__m128i acc_hi = vround;
+		for (unsigned int j = 0; j < kernel_size; j += 2)
+		{
+			bool pair = j + 1 < kernel_size;
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(taps[j] + i)), zero);
+			__m128i b = pair ? _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(taps[j + 1] + i)), zero) : zero;
+			//the high coefficient is shifted unsigned, shifting negative int
+			//is undefined
+			__m128i coef = _mm_set1_epi32((int)((uint32_t)(uint16_t)qkernel[j] |
+												((uint32_t)(uint16_t)(pair ? qkernel[j + 1] : 0) << 16)));
+			acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), coef));
+			acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), coef));
+		}
+		store8(_mm_sra_epi32(acc_lo, vshift), _mm_sra_epi32(acc_hi, vshift), out + i);
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		int acc = half;
+		for (unsigned int j = 0; j < kernel_size; ++j)
+		{
+			acc += taps[j][i] * qkernel[j];
+		}
+		saturate(acc >> frac_bits, out[i]);
+	}
+}
+
+template <typename T>
+void Convolution::convolve1DFixed(Image &image, T * result, unsigned int kernel_size, short * qkernel, int frac_bits, int direction)
+{
+	int width = image.width;
+	int height = image.height;
+	assert(image.contiguousRows());
+	assert(kernel_size <= CONV_MAX_FIXED_TAPS);
+	std::vector<const unsigned char *> taps(kernel_size);
+	
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char *row = image.row(y);
+		T *out = result + y * width;
+		if (direction == DIR_VERT)
+		{
+			for (int t = 0; t < (int)kernel_size; ++t)
+			{
+				int y_t = y - t;
+				taps[t] = image.row(y_t >= 0 ? y_t : 0);
+			}
+			convolveRowFixed<T>(taps.data(), qkernel, kernel_size, frac_bits, width, out);
+		}
+		else
+		{
+			//left border with clamped taps
+			int border = std::min((int)kernel_size - 1, width);
+			for (int x = 0; x < border; ++x)
+			{
+				int acc = frac_bits > 0 ? 1 << (frac_bits - 1) : 0;
+				for (int s = 0; s < (int)kernel_size; ++s)
+				{
+					int x_s = x - s;
+					acc += row[x_s >= 0 ? x_s : 0] * qkernel[s];
+				}
+				saturate(acc >> frac_bits, out[x]);
+			}
+			for (int s = 0; s < (int)kernel_size; ++s)
+			{
+				taps[s] = row + border - s;
+			}
+			convolveRowFixed<T>(taps.data(), qkernel, kernel_size, frac_bits, width - border, out + border);
+		}
+	}
+}
+
+static inline float convolveClamped(const float * row, int x, int width, int n, const float * kernel, int anchor)
+{
+	float res = 0;
+	for (int s = 0; s < n; ++s)
+	{
+		int x_s = x + anchor - s;
+		x_s = x_s < 0 ? 0 : (x_s >= width ? width - 1 : x_s);
+		res += row[x_s] * kernel[s];
+	}
+	return res;
+}
+
+void Convolution::convolveRow(const float * row, float * out, int width, unsigned int kernel_size, const float * kernel, int anchor)
+{
+	int n = (int)kernel_size;
+	//interior pixels, where no clamping is needed: 0 <= x + anchor - s < width
+	int begin = std::min(std::max(n - 1 - anchor, 0), width);
+	int end = std::max(std::min(width - anchor, width), begin);
+	
+	for (int x = 0; x < begin; ++x)
+	{
+		out[x] = convolveClamped(row, x, width, n, kernel, anchor);
+	}
+	//taps in the outer loop, so that the loop over pixels is vectorized, the
+	//sums are accumulated in the same order as by convolveClamped()
+	for (int x = begin; x < end; ++x)
+	{
+		out[x] = row[x + anchor] * kernel[0];
+	}
+	for (int s = 1; s < n; ++s)
+	{
+		const float *src = row + anchor - s;
+		const float k = kernel[s];
+		for (int x = begin; x < end; ++x)
+		{
+			out[x] += src[x] * k;
+		}
+	}
+	for (int x = end; x < width; ++x)
+	{
+		out[x] = convolveClamped(row, x, width, n, kernel, anchor);
+	}
+}
+
+void Convolution::combineRows(const float * const * rows, float * out, int width, unsigned int kernel_size, const float * kernel)
+{
+	for (int x = 0; x < width; ++x)
+	{
+		out[x] = rows[0][x] * kernel[0];
+	}
+	for (unsigned int t = 1; t < kernel_size; ++t)
+	{
+		const float *row = rows[t];
+		const float k = kernel[t];
+		for (int x = 0; x < width; ++x)
+		{
+			out[x] += row[x] * k;
+		}
+	}
+}
+
+void Convolution::boxFilter(CImg<float> &image, CImg<float> &result, int radius, bool normalize)
+{
+	assert(image.width() == result.width() &&
+		   image.height() == result.height() &&
+		   image.spectrum() == result.spectrum());
+	//the threads read the clamped rows around their range, which the
+	//neighbouring threads would overwrite
+	assert(&image != &result);
+	assert(radius >= 0);
+	
+	int width = image.width();
+	int height = image.height();
+	const double scale = normalize ? 1.0 / ((2.0 * radius + 1) * (2.0 * radius + 1)) : 1.0;
+	
+	for (int c = 0; c < image.spectrum(); ++c)
+	{
+		const float *in = image.data(0, 0, 0, c);
+		float *out = result.data(0, 0, 0, c);
+		Parallel::forRange(0, height, [=](int from, int to)
+		{
+			std::vector<double> col(width, 0.0);
+			auto clampedRow = [=](int y)
+			{
+				return in + (size_t)std::min(std::max(y, 0), height - 1) * width;
+			};
+			for (int t = from - radius; t <= from + radius; ++t)
+			{
+				const float *row = clampedRow(t);
+				for (int x = 0; x < width; ++x)
+				{
+					col[x] += row[x];
+				}
+			}
+			for (int y = from; y < to; ++y)
+			{
+				if (y > from)
+				{
+					//slide the window by one row
+					const float *add = clampedRow(y + radius);
+					const float *sub = clampedRow(y - radius - 1);
+					for (int x = 0; x < width; ++x)
+					{
+						col[x] += (double)add[x] - (double)sub[x];
+					}
+				}
+				//running sum along the row over the column sums
+				double acc = 0;
+				for (int s = -radius; s <= radius; ++s)
+				{
+					acc += col[std::min(std::max(s, 0), width - 1)];
+				}
+				float *ro = out + (size_t)y * width;
+				for (int x = 0; x < width; ++x)
+				{
+					ro[x] = (float)(acc * scale);
+					acc += col[std::min(x + radius + 1, width - 1)] - col[std::max(x - radius, 0)];
+				}
+			}
+		}, 64);
+	}
+}
+
+void Convolution::convolve2DDirect(CImg<float> &image, CImg<float> &result, CImg<float> &kernel)
+{
+	assert(&image != &result);
+	assert(image.width() == result.width() &&
+		   image.height() == result.height() &&
+		   image.spectrum() == result.spectrum());
+	
+	int width = image.width();
+	int height = image.height();
+	int kernel_w = kernel.width();
+	int kernel_h = kernel.height();
+	int cy = kernel_h / 2;
+	
+	for (int c = 0; c < image.spectrum(); ++c)
+	{
+		Parallel::forRange(0, height, [&, c](int from, int to)
+		{
+			std::vector<float> tmp(width);
+			for (int y = from; y < to; ++y)
+			{
+				float *out = result.data(0, y, 0, c);
+				std::fill(out, out + width, 0.0f);
+				//sum of the horizontal convolutions of the rows with the
+				//corresponding kernel rows
+				for (int j = 0; j < kernel_h; ++j)
+				{
+					int y_j = std::min(std::max(y + cy - j, 0), height - 1);
+					convolveRow(image.data(0, y_j, 0, c), tmp.data(), width,
+								kernel_w, kernel.data(0, j), kernel_w / 2);
+					for (int x = 0; x < width; ++x)
+					{
+						out[x] += tmp[x];
+					}
+				}
+			}
+		}, 16);
+	}
+}
+
+void Convolution::convolve2D(CImg<float> &image, CImg<float> &result, CImg<float> &kernel)
+{
+	if (kernel.width() * kernel.height() <= FFT_KERNEL_AREA_THRESHOLD)
+	{
+		convolve2DDirect(image, result, kernel);
+		return;
+	}
+	
+	//FNV-1a hash of the kernel selects the candidates, the kernels are compared
+	unsigned long long key = 14695981039346656037ULL;
+	const unsigned char *bytes = (const unsigned char *)kernel.data();
+	for (size_t i = 0; i < kernel.size() * sizeof(float); ++i)
+	{
+		key = (key ^ bytes[i]) * 1099511628211ULL;
+	}
+	
+	struct CachedKernel
+	{
+		unsigned long long key;
+		CImg<float> kernel;
+		std::shared_ptr<FFTConvolver> conv;
+	};
+	//most recently used first
+	static std::mutex cache_mutex;
+	static std::list<CachedKernel> cache;
+	std::shared_ptr<FFTConvolver> conv;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		std::list<CachedKernel>::iterator it = cache.begin();
+		for (; it != cache.end(); ++it)
+		{
+			if (it->key == key && it->kernel.is_sameXYZC(kernel) &&
+				std::equal(kernel.begin(), kernel.end(), it->kernel.begin()))
+				break;
+		}
+		if (it != cache.end())
+		{
+			cache.splice(cache.begin(), cache, it);
+			conv = it->conv;
+		}
+		else
+		{
+			if (cache.size() >= FFT_KERNEL_CACHE_SIZE)
+				cache.pop_back();
+			CachedKernel entry;
+			entry.key = key;
+			entry.kernel.assign(kernel);
+			entry.conv = std::make_shared<FFTConvolver>(kernel);
+			cache.push_front(entry);
+			conv = entry.conv;
+		}
+	}
+	conv->apply(image, result);
+}
@@ -0,0 +1,222 @@
+//
+//  ConvolutionPipeline.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "ConvolutionPipeline.h"
+
+PipelineStage::PipelineStage(int width, int in_channels, int out_channels)
+: width(width), in_channels(in_channels), out_channels(out_channels), next(NULL)
+{
+}
+
+void PipelineStage::finish()
+{
+	if (next)
+		next->finish();
+}
+
+void PipelineStage::emit(const float * row)
+{
+	if (next)
+		next->push(row);
+}
+
+
+HorizontalStage::HorizontalStage(int width, int channels, const float * kernel,
+								 unsigned int kernel_size, int anchor,
+								 int first_channel, int num_channels)
+: PipelineStage(width, channels, channels), kernel(kernel, kernel + kernel_size),
+anchor(anchor), first_channel(first_channel), num_channels(num_channels)
+{
+	assert(first_channel >= 0 && first_channel + num_channels <= channels);
+	buffer.resize(width * channels);
+}
+
+void HorizontalStage::push(const float * row)
+{
+	for (int c = 0; c < in_channels; ++c)
+	{
+		const float *in = row + c * width;
+		float *out = &buffer[c * width];
+		if (c >= first_channel && c < first_channel + num_channels)
+		{
+			Convolution::convolveRow(in, out, width, kernel.size(), kernel.data(), anchor);
+		}
+		else
+		{
+			std::copy(in, in + width, out);
+		}
+	}
+	emit(buffer.data());
+}
+
+
+VerticalStage::VerticalStage(int width, int channels, const float * kernel,
+							 unsigned int kernel_size, int anchor,
+							 int first_channel, int num_channels)
+: PipelineStage(width, channels, channels), kernel(kernel, kernel + kernel_size),
+rows(kernel_size), anchor(anchor), first_channel(first_channel),
+num_channels(num_channels), received(0)
+{
+	assert(first_channel >= 0 && first_channel + num_channels <= channels);
+	if (anchor < 0 || anchor >= (int)kernel_size)
+		throw std::runtime_error("Anchor of the vertical kernel has to be in \
+								 <0, kernel_size).");
+	buffer.resize((kernel_size + 1) * width * channels);
+}
+
+void VerticalStage::push(const float * row)
+{
+	std::copy(row, row + width * in_channels, ringRow(received));
+	++received;
+	
+	int y = received - 1 - anchor;
+	if (y >= 0)
+	{
+		emitRow(y, received - 1);
+	}
+}
+
+void VerticalStage::finish()
+{
+	for (int y = std::max(received - anchor, 0); y < received; ++y)
+	{
+		emitRow(y, received - 1);
+	}
+	received = 0;
+	PipelineStage::finish();
+}
+
+void VerticalStage::emitRow(int y, int last)
+{
+	int n = kernel.size();
+	float *out = &buffer[n * width * in_channels];
+	for (int c = 0; c < in_channels; ++c)
+	{
+		int offset = c * width;
+		if (c >= first_channel && c < first_channel + num_channels)
+		{
+			for (int t = 0; t < n; ++t)
+			{
+				int y_t = y + anchor - t;
+				y_t = y_t < 0 ? 0 : (y_t > last ? last : y_t);
+				rows[t] = ringRow(y_t) + offset;
+			}
+			Convolution::combineRows(rows.data(), out + offset, width, n, kernel.data());
+		}
+		else
+		{
+			const float *in = ringRow(y) + offset;
+			std::copy(in, in + width, out + offset);
+		}
+	}
+	emit(out);
+}
+
+
+MapStage::MapStage(int width, int in_channels, int out_channels, MapFunction fn)
+: PipelineStage(width, in_channels, out_channels), fn(fn)
+{
+	buffer.resize(width * out_channels);
+}
+
+void MapStage::push(const float * row)
+{
+	fn(row, buffer.data(), width);
+	emit(buffer.data());
+}
+
+
+SinkStage::SinkStage(int width, int channels, SinkFunction fn)
+: PipelineStage(width, channels, channels), fn(fn), y(0)
+{
+}
+
+void SinkStage::push(const float * row)
+{
+	fn(y++, row);
+}
+
+void SinkStage::finish()
+{
+	y = 0;
+}
+
+
+ConvolutionPipeline::ConvolutionPipeline(int width, int channels)
+: width(width), in_channels(channels)
+{
+}
+
+ConvolutionPipeline::~ConvolutionPipeline()
+{
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		delete stages[i];
+	}
+}
+
+void ConvolutionPipeline::addHorizontal(const float * kernel, unsigned int kernel_size,
+										int anchor, int first_channel, int num_channels)
+{
+	int c = channels();
+	add(new HorizontalStage(width, c, kernel, kernel_size, anchor, first_channel,
+							num_channels < 0 ? c - first_channel : num_channels));
+}
+
+void ConvolutionPipeline::addVertical(const float * kernel, unsigned int kernel_size,
+									  int anchor, int first_channel, int num_channels)
+{
+	int c = channels();
+	add(new VerticalStage(width, c, kernel, kernel_size, anchor, first_channel,
+						  num_channels < 0 ? c - first_channel : num_channels));
+}
+
+void ConvolutionPipeline::addMap(int out_channels, MapStage::MapFunction fn)
+{
+	add(new MapStage(width, channels(), out_channels, fn));
+}
+
+void ConvolutionPipeline::addSink(SinkStage::SinkFunction fn)
+{
+	add(new SinkStage(width, channels(), fn));
+}
+
+void ConvolutionPipeline::push(const float * row)
+{
+	assert(!stages.empty());
+	stages[0]->push(row);
+}
+
+void ConvolutionPipeline::finish()
+{
+	assert(!stages.empty());
+	stages[0]->finish();
+}
+
+size_t ConvolutionPipeline::bufferSize() const
+{
+	size_t size = 0;
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		size += stages[i]->bufferSize();
+	}
+	return size;
+}
+
+void ConvolutionPipeline::add(PipelineStage * stage)
+{
+	if (!stages.empty())
+	{
+		stages.back()->setNext(stage);
+	}
+	stages.push_back(stage);
+}
+
+int ConvolutionPipeline::channels() const
+{
+	return stages.empty() ? in_channels : stages.back()->outChannels();
+}
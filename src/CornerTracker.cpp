@@ -0,0 +1,313 @@
+//
+//  CornerTracker.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "CornerTracker.h"
+
+// Lucas-Kanade iterations per pyramid level
+#define LK_ITERATIONS 20
+// iterations stop when the update is shorter than this (in pixels)
+#define LK_EPSILON 0.01f
+// minimal smaller eigenvalue of the window structure tensor per pixel
+#define LK_MIN_EIGENVALUE 0.01f
+// maximal mean absolute residual of a tracked window
+#define LK_MAX_ERROR 20.0f
+
+/**
+ Bilinear interpolation of plane p with coordinates clamped to the plane.
+ */
+static inline float bilinear(const float * p, int width, int height, float x, float y)
+{
+	x = std::min(std::max(x, 0.0f), (float)(width - 1));
+	y = std::min(std::max(y, 0.0f), (float)(height - 1));
+	int x0 = std::min((int)x, width - 2 < 0 ? 0 : width - 2);
+	int y0 = std::min((int)y, height - 2 < 0 ? 0 : height - 2);
+	int x1 = std::min(x0 + 1, width - 1);
+	int y1 = std::min(y0 + 1, height - 1);
+	float ax = x - x0;
+	float ay = y - y0;
+	const float *r0 = p + (size_t)y0 * width;
+	const float *r1 = p + (size_t)y1 * width;
+	return (1 - ay) * ((1 - ax) * r0[x0] + ax * r0[x1]) + ay * ((1 - ax) * r1[x0] + ax * r1[x1]);
+}
+
+CornerTracker::CornerTracker(int max_corners, int keyframe_interval, int grid_size,
+							 float threshold, int levels, int window)
+:max_corners(max_corners), keyframe_interval(std::max(keyframe_interval, 1)),
+grid_size(std::max(grid_size, 1)), threshold(threshold), window(window),
+frame_index(0), next_id(0),
+pyramids{HarrisLaplaceDetector(levels), HarrisLaplaceDetector(levels)}, cur(0)
+{
+}
+
+const std::vector<Track> &CornerTracker::process(Image &gray)
+{
+	cur ^= 1;
+	pyramids[cur].buildPyramid(gray);
+	computeGradients(pyramids[cur], gradients[cur]);
+	
+	if (frame_index > 0)
+	{
+		std::vector<char> alive(current.size());
+		Parallel::forRange(0, (int)current.size(), [&](int from, int to)
+		{
+			for (int i = from; i < to; ++i)
+			{
+				float nx, ny;
+				alive[i] = trackPoint(current[i].x, current[i].y, nx, ny);
+				current[i].x = nx;
+				current[i].y = ny;
+			}
+		}, 32);
+		
+		size_t kept = 0;
+		for (size_t i = 0; i < current.size(); ++i)
+		{
+			if (alive[i])
+			{
+				current[kept] = current[i];
+				++current[kept].age;
+				++kept;
+			}
+		}
+		current.resize(kept);
+	}
+	
+	detect(gray, frame_index % keyframe_interval == 0);
+	++frame_index;
+	return current;
+}
+
+void CornerTracker::computeGradients(const HarrisLaplaceDetector &pyramid,
+									 std::vector<Gradient> &grads)
+{
+	if ((int)grads.size() < pyramid.levelCount())
+		grads.resize(pyramid.levelCount());
+	
+	for (int l = 0; l < pyramid.levelCount(); ++l)
+	{
+		int width = pyramid.levelWidth(l);
+		int height = pyramid.levelHeight(l);
+		const float *I = pyramid.smoothed(l);
+		Gradient &g = grads[l];
+		g.Ix.resize((size_t)width * height);
+		g.Iy.resize((size_t)width * height);
+		Parallel::forRange(0, height, [&](int from, int to)
+		{
+			for (int y = from; y < to; ++y)
+			{
+				const float *row = I + (size_t)y * width;
+				const float *up = I + (size_t)std::max(y - 1, 0) * width;
+				const float *down = I + (size_t)std::min(y + 1, height - 1) * width;
+				float *ix = &g.Ix[(size_t)y * width];
+				float *iy = &g.Iy[(size_t)y * width];
+				for (int x = 0; x < width; ++x)
+				{
+					ix[x] = (row[std::min(x + 1, width - 1)] - row[std::max(x - 1, 0)]) * 0.5f;
+					iy[x] = (down[x] - up[x]) * 0.5f;
+				}
+			}
+		}, 64);
+	}
+}
+
+bool CornerTracker::trackPoint(float x, float y, float &nx, float &ny) const
+{
+	const HarrisLaplaceDetector &P = pyramids[cur ^ 1];
+	const HarrisLaplaceDetector &C = pyramids[cur];
+	const std::vector<Gradient> &grads = gradients[cur ^ 1];
+	int levels = std::min(P.levelCount(), C.levelCount());
+	int side = 2 * window + 1;
+	int n = side * side;
+	//template intensities and gradients of the window
+	std::vector<float> T(n), Gx(n), Gy(n);
+	
+	nx = x;
+	ny = y;
+	float gx = 0;
+	float gy = 0;
+	float error = 0;
+	for (int l = levels - 1; l >= 0; --l)
+	{
+		float step = (float)(1 << l);
+		float px = x / step;
+		float py = y / step;
+		int width = P.levelWidth(l);
+		int height = P.levelHeight(l);
+		const float *I = P.smoothed(l);
+		const float *J = C.smoothed(l);
+		
+		float gxx = 0, gxy = 0, gyy = 0;
+		for (int j = -window, k = 0; j <= window; ++j)
+		{
+			for (int i = -window; i <= window; ++i, ++k)
+			{
+				T[k] = bilinear(I, width, height, px + i, py + j);
+				Gx[k] = bilinear(grads[l].Ix.data(), width, height, px + i, py + j);
+				Gy[k] = bilinear(grads[l].Iy.data(), width, height, px + i, py + j);
+				gxx += Gx[k] * Gx[k];
+				gxy += Gx[k] * Gy[k];
+				gyy += Gy[k] * Gy[k];
+			}
+		}
+		float det = gxx * gyy - gxy * gxy;
+		float min_eig = (gxx + gyy - std::sqrt((gxx - gyy) * (gxx - gyy) + 4 * gxy * gxy)) / (2 * n);
+		if (min_eig < LK_MIN_EIGENVALUE || det <= 0)
+			return false;
+		
+		float vx = 0;
+		float vy = 0;
+		for (int it = 0; it < LK_ITERATIONS; ++it)
+		{
+			float bx = 0, by = 0;
+			error = 0;
+			for (int j = -window, k = 0; j <= window; ++j)
+			{
+				for (int i = -window; i <= window; ++i, ++k)
+				{
+					float e = T[k] - bilinear(J, width, height, px + gx + vx + i, py + gy + vy + j);
+					bx += e * Gx[k];
+					by += e * Gy[k];
+					error += std::fabs(e);
+				}
+			}
+			float dx = (gyy * bx - gxy * by) / det;
+			float dy = (gxx * by - gxy * bx) / det;
+			vx += dx;
+			vy += dy;
+			if (dx * dx + dy * dy < LK_EPSILON * LK_EPSILON)
+				break;
+		}
+		
+		if (l > 0)
+		{
+			gx = 2 * (gx + vx);
+			gy = 2 * (gy + vy);
+		}
+		else
+		{
+			gx += vx;
+			gy += vy;
+		}
+	}
+	
+	nx = x + gx;
+	ny = y + gy;
+	int width = C.levelWidth(0);
+	int height = C.levelHeight(0);
+	return nx >= 0 && ny >= 0 && nx <= width - 1 && ny <= height - 1 &&
+		   error / n <= LK_MAX_ERROR;
+}
+
+void CornerTracker::detect(Image &gray, bool keyframe)
+{
+	int width = gray.width;
+	int height = gray.height;
+	int cells = grid_size * grid_size;
+	int quota = std::max(max_corners / cells, 1);
+	auto cellOf = [&](float x, float y)
+	{
+		int cx = std::min(std::max((int)(x * grid_size / width), 0), grid_size - 1);
+		int cy = std::min(std::max((int)(y * grid_size / height), 0), grid_size - 1);
+		return cy * grid_size + cx;
+	};
+	
+	std::vector<int> occupied(cells, 0);
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		++occupied[cellOf(current[i].x, current[i].y)];
+	}
+	std::vector<char> needy(cells, 0);
+	std::vector<char> needy_row(grid_size, 0);
+	for (int c = 0; c < cells; ++c)
+	{
+		needy[c] = keyframe ? occupied[c] < quota : occupied[c] == 0;
+		needy_row[c / grid_size] |= needy[c];
+	}
+	
+	//mask of the window sized blocks which already contain a corner, new
+	//corners keep distance from the tracked ones
+	int block = std::max(window, 1);
+	int mask_w = width / block + 1;
+	int mask_h = height / block + 1;
+	std::vector<char> mask((size_t)mask_w * mask_h, 0);
+	auto blocked = [&](float x, float y)
+	{
+		int bx = (int)x / block;
+		int by = (int)y / block;
+		for (int v = std::max(by - 1, 0); v <= std::min(by + 1, mask_h - 1); ++v)
+			for (int u = std::max(bx - 1, 0); u <= std::min(bx + 1, mask_w - 1); ++u)
+				if (mask[(size_t)v * mask_w + u])
+					return true;
+		return false;
+	};
+	auto occupy = [&](float x, float y)
+	{
+		mask[(size_t)((int)y / block) * mask_w + (int)x / block] = 1;
+	};
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		occupy(current[i].x, current[i].y);
+	}
+	
+	//the response is computed only for the bands of grid rows with cells to
+	//be refilled, extended by the suppression radius
+	std::vector< std::vector<Keypoint> > candidates(cells);
+	response_plane.resize((size_t)width * height);
+	for (int gy = 0; gy < grid_size; )
+	{
+		if (!needy_row[gy])
+		{
+			++gy;
+			continue;
+		}
+		int last = gy;
+		while (last + 1 < grid_size && needy_row[last + 1])
+			++last;
+		int y0 = gy * height / grid_size;
+		int y1 = (last + 1) * height / grid_size;
+		int r0 = std::max(y0 - 1, 0);
+		int r1 = std::min(y1 + 1, height);
+		float *R = response_plane.data();
+		HarrisCornerDetector::response(gray, [=](int y, const float *row)
+		{
+			std::copy(row, row + width, R + (size_t)y * width);
+		}, r0, r1);
+		std::vector<Keypoint> found = HarrisCornerDetector::nonMaxSuppression(
+			R + (size_t)r0 * width, width, r1 - r0, 1, threshold);
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			found[i].y += r0;
+			int c = cellOf(found[i].x, found[i].y);
+			if (found[i].y >= y0 && found[i].y < y1 && needy[c])
+				candidates[c].push_back(found[i]);
+		}
+		gy = last + 1;
+	}
+	
+	for (int c = 0; c < cells; ++c)
+	{
+		std::vector<Keypoint> &cand = candidates[c];
+		std::sort(cand.begin(), cand.end(), [](const Keypoint &a, const Keypoint &b)
+		{
+			return a.response > b.response;
+		});
+		int missing = quota - occupied[c];
+		for (size_t i = 0; i < cand.size() && missing > 0; ++i)
+		{
+			if (blocked(cand[i].x, cand[i].y))
+				continue;
+			occupy(cand[i].x, cand[i].y);
+			Track t;
+			t.id = next_id++;
+			t.x = cand[i].x;
+			t.y = cand[i].y;
+			t.age = 0;
+			current.push_back(t);
+			--missing;
+		}
+	}
+}
@@ -0,0 +1,112 @@
+//
+//  FFTConvolver.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "FFTConvolver.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+FFTConvolver::FFTConvolver(const CImg<float> &kernel, int _fft_size)
+: kernel_w(kernel.width()), kernel_h(kernel.height()), fft_size(_fft_size)
+{
+	int kmax = std::max(kernel_w, kernel_h);
+	if (fft_size <= 0)
+	{
+		//four times the kernel keeps the overlap below 1/4 of the tile
+		fft_size = 64;
+		while (fft_size < 4 * kmax)
+			fft_size <<= 1;
+	}
+	if ((fft_size & (fft_size - 1)) || fft_size <= kmax)
+		throw std::runtime_error("FFT size has to be power of two greater than \
+								 the kernel size.");
+	
+	tile_w = fft_size - kernel_w + 1;
+	tile_h = fft_size - kernel_h + 1;
+	
+	kernel_re.assign(fft_size, fft_size, 1, 1, 0);
+	kernel_im.assign(fft_size, fft_size, 1, 1, 0);
+	for (int j = 0; j < kernel_h; ++j)
+	{
+		for (int i = 0; i < kernel_w; ++i)
+		{
+			kernel_re(i, j) = kernel(i, j, 0, 0);
+		}
+	}
+	CImg<float>::FFT(kernel_re, kernel_im);
+}
+
+void FFTConvolver::apply(const CImg<float> &image, CImg<float> &result) const
+{
+	//the input blocks of the tiles overlap, the result of one tile would
+	//overwrite the input of its neighbours
+	assert(&image != &result);
+	result.assign(image.width(), image.height(), 1, image.spectrum());
+	
+	int tiles_x = (image.width() + tile_w - 1) / tile_w;
+	int tiles_y = (image.height() + tile_h - 1) / tile_h;
+	int tiles = tiles_x * tiles_y;
+	
+	for (int c = 0; c < image.spectrum(); ++c)
+	{
+		Parallel::forRange(0, tiles, [&, c](int from, int to)
+		{
+			CImg<float> re(fft_size, fft_size);
+			CImg<float> im(fft_size, fft_size);
+			for (int t = from; t < to; ++t)
+			{
+				applyTile(image, result, (t % tiles_x) * tile_w, (t / tiles_x) * tile_h, c, re, im);
+			}
+		});
+	}
+}
+
+void FFTConvolver::applyTile(const CImg<float> &image, CImg<float> &result,
+							 int x0, int y0, int c, CImg<float> &re, CImg<float> &im) const
+{
+	int width = image.width();
+	int height = image.height();
+	//input block starts kernel - 1 - center pixels before the output tile,
+	//the first kernel - 1 rows and columns of the circular convolution
+	//are wrapped around and are discarded.
+	int bx = x0 - (kernel_w - 1 - kernel_w / 2);
+	int by = y0 - (kernel_h - 1 - kernel_h / 2);
+	
+	for (int q = 0; q < fft_size; ++q)
+	{
+		int y = std::min(std::max(by + q, 0), height - 1);
+		const float *row = image.data(0, y, 0, c);
+		float *dst = re.data(0, q);
+		for (int p = 0; p < fft_size; ++p)
+		{
+			dst[p] = row[std::min(std::max(bx + p, 0), width - 1)];
+		}
+	}
+	im.fill(0);
+	CImg<float>::FFT(re, im);
+	
+	//multiply by the kernel spectrum
+	const float *kr = kernel_re.data();
+	const float *ki = kernel_im.data();
+	float *r = re.data();
+	float *i = im.data();
+	for (size_t n = 0; n < re.size(); ++n)
+	{
+		float a = r[n], b = i[n];
+		r[n] = a * kr[n] - b * ki[n];
+		i[n] = a * ki[n] + b * kr[n];
+	}
+	CImg<float>::FFT(re, im, true);
+	
+	int w = std::min(tile_w, width - x0);
+	int h = std::min(tile_h, height - y0);
+	for (int q = 0; q < h; ++q)
+	{
+		const float *src = re.data(kernel_w - 1, kernel_h - 1 + q);
+		std::copy(src, src + w, result.data(x0, y0 + q, 0, c));
+	}
+}
@@ -10,11 +10,22 @@
 
 GradientStitcher::GradientStitcher(string input_path,
 								   string stitch_path,
-								   string mask_path)
+								   string mask_path,
+								   bool half_precision)
+:GradientStitcher(CImg<float>(input_path.c_str()), CImg<float>(stitch_path.c_str()),
+				  CImg<float>(mask_path.c_str()), half_precision)
 {
-	input_img = CImg<float>(input_path.c_str()).normalize(0, 1);
-	CImg<float> stitch_img = CImg<float>(stitch_path.c_str()).normalize(0, 1);
-	CImg<float> mask_img = CImg<float>(mask_path.c_str()).normalize(0, 1);
+}
+
+GradientStitcher::GradientStitcher(const CImg<float> &input,
+								   const CImg<float> &stitch,
+								   const CImg<float> &mask,
+								   bool half_precision)
+:half_precision(half_precision)
+{
+	input_img = input.get_normalize(0, 1);
+	CImg<float> stitch_img = stitch.get_normalize(0, 1);
+	CImg<float> mask_img = mask.get_normalize(0, 1);
 	
 	assert(input_img.height() == stitch_img.height() &&
 		   input_img.width() == stitch_img.width());
@@ -27,19 +38,22 @@ GradientStitcher::GradientStitcher(string input_path,
 	
 	mask_bbox = calculateMaskBBox(mask_img);
 	
-	CImg<float> G_x = CImg<float>(width, height, 1, spectrum);
-	CImg<float> G_y = CImg<float>(width, height, 1, spectrum);
+	//gradient planes come from the pool, the CImgs only share them
+	size_t size = (size_t)width * height * spectrum;
+	PooledBuffer<float> G_x_buffer(size), G_y_buffer(size);
+	PooledBuffer<float> stitch_G_x_buffer(size), stitch_G_y_buffer(size);
+	CImg<float> G_x(G_x_buffer.data(), width, height, 1, spectrum, true);
+	CImg<float> G_y(G_y_buffer.data(), width, height, 1, spectrum, true);
 	
 	//std::cout << "width: " << G_x.width() << ", height: " << G_x.width() << ", spectrum: " << spectrum << std::endl;
 	
-	CImg<float> stitch_G_x = CImg<float>(width, height, 1, spectrum);
-	CImg<float> stitch_G_y = CImg<float>(width, height, 1, spectrum);
+	CImg<float> stitch_G_x(stitch_G_x_buffer.data(), width, height, 1, spectrum, true);
+	CImg<float> stitch_G_y(stitch_G_y_buffer.data(), width, height, 1, spectrum, true);
 	
-	float kernel[2] = {1, -1};
-	Convolution::convolve1D(input_img, G_x, 2, kernel, DIR_HORIZ);
-	Convolution::convolve1D(input_img, G_y, 2, kernel, DIR_VERT);
-	Convolution::convolve1D(stitch_img, stitch_G_x, 2, kernel, DIR_HORIZ);
-	Convolution::convolve1D(stitch_img, stitch_G_y, 2, kernel, DIR_VERT);
+	Convolution::convolve<IntKernel<1, -1> >(input_img, G_x, DIR_HORIZ);
+	Convolution::convolve<IntKernel<1, -1> >(input_img, G_y, DIR_VERT);
+	Convolution::convolve<IntKernel<1, -1> >(stitch_img, stitch_G_x, DIR_HORIZ);
+	Convolution::convolve<IntKernel<1, -1> >(stitch_img, stitch_G_y, DIR_VERT);
 	
 	paste(stitch_G_x, G_x, mask_img);
 	paste(stitch_G_y, G_y, mask_img);
@@ -48,16 +62,14 @@ GradientStitcher::GradientStitcher(string input_path,
 	paste(stitch_img, input_img, mask_img);
 	
 	//second derivative
-	Convolution::convolve1D(G_x, stitch_G_x, 2, kernel, DIR_HORIZ);
-	Convolution::convolve1D(G_y, stitch_G_y, 2, kernel, DIR_VERT);
+	Convolution::convolve<IntKernel<1, -1> >(G_x, stitch_G_x, DIR_HORIZ);
+	Convolution::convolve<IntKernel<1, -1> >(G_y, stitch_G_y, DIR_VERT);
 	
 	//make stitch_G_x is equal to divergence of vector field (G_x, G_y)
 	//div G = dG_x/dx + dG_y/dy;
 	stitch_G_x += stitch_G_y;
 	setBorder(stitch_G_x, 0, 1);
 	div_G = stitch_G_x;
-	
-	CImg<float> output_img = CImg<float>(width, height, 1, spectrum);
 }
 
 
@@ -74,7 +86,16 @@ CImg<float> GradientStitcher::stitchGaussSeidel(float tolerance,
 	setBorderConditions(input_img, div_G);
 	//div_G.display();
 	
-	gaussSeidel(crop_input, div_G, output_img_crop, tolerance, display_calculation);
+	if (half_precision)
+	{
+		PooledBuffer<Half> div_G_half(div_G.size());
+		HalfFloat::toHalf(div_G.data(), div_G_half.data(), (int)div_G.size());
+		gaussSeidel(crop_input, div_G_half.data(), output_img_crop, tolerance, display_calculation);
+	}
+	else
+	{
+		gaussSeidel(crop_input, div_G.data(), output_img_crop, tolerance, display_calculation);
+	}
 	//conjugateGradient(crop_input, div_G, output_img_crop);
 	clamp(output_img_crop, 0, 1);
 	
@@ -86,8 +107,9 @@ CImg<float> GradientStitcher::stitchGaussSeidel(float tolerance,
 	return output_img;
 }
 
+template <typename S>
 void GradientStitcher::gaussSeidel(CImg<float> &input,
-								   CImg<float> &div_G,
+								   const S *div_G,
 								   CImg<float> &output,
 								   float tolerance,
 								   bool display_calculation)
@@ -95,6 +117,7 @@ void GradientStitcher::gaussSeidel(CImg<float> &input,
 	int height = input.height();
 	int width = input.width();
 	int spectrum = input.spectrum();
+	PooledBuffer<float> div_row(width);
 	//iterate until convergence
 	
 	CImg<float> *in = &input;
@@ -111,17 +134,19 @@ void GradientStitcher::gaussSeidel(CImg<float> &input,
 	
 	while (true)
 	{
-		for (int y = 1; y < height-1; ++y)
+		for (int c = 0; c < spectrum; ++c)
 		{
-			for (int x = 1; x < width-1; ++x)
+			for (int y = 1; y < height-1; ++y)
 			{
-				for (int c = 0; c < spectrum; ++c)
+				const float *row = in->data(0, y, 0, c);
+				const float *up = in->data(0, y-1, 0, c);
+				const float *down = in->data(0, y+1, 0, c);
+				const float *div = HalfFloat::loadRow(div_G + ((size_t)c * height + y) * width,
+													  div_row.data(), width);
+				float *res = out->data(0, y, 0, c);
+				for (int x = 1; x < width-1; ++x)
 				{
-					(*out)(x, y, 0, c) =	0.25 * ((*in)(x+1, y, 0, c) +
-													(*in)(x-1, y, 0, c) +
-													(*in)(x, y+1, 0, c) +
-													(*in)(x, y-1, 0, c) -
-													div_G(x, y, 0, c));
+					res[x] = 0.25 * (row[x+1] + row[x-1] + down[x] + up[x] - div[x]);
 				}
 			}
 		}
@@ -339,13 +364,12 @@ void GradientStitcher::paste(const CImg<float> &src,
 void GradientStitcher::setMaskBorderZero(CImg<float> &mask,
 										 CImg<float> img)
 {
-	float kernel[2] = {1, -1};
 	int width = mask.width();
 	int height = mask.height();
 	CImg<float> gmask = CImg<float>(width, height,
 									mask.depth(), mask.spectrum());
-	Convolution::convolve1D(mask, gmask, 2, kernel, DIR_HORIZ);
-	Convolution::convolve1D(mask, gmask, 2, kernel, DIR_VERT);
+	Convolution::convolve<IntKernel<1, -1> >(mask, gmask, DIR_HORIZ);
+	Convolution::convolve<IntKernel<1, -1> >(mask, gmask, DIR_VERT);
 	for (int y = 0; y < height; ++y)
 	{
 		for (int x = 0; x < width; ++x)
@@ -22,6 +22,8 @@
 #include <Eigen/SparseLU>
 
 #include "Convolution.h"
+#include "BufferPool.h"
+#include "HalfFloat.h"
 #include "ImageUtil.h"
 
 // must be at end (after Eigen), because Eigen defines Success as well as X11 does.
@@ -38,6 +40,9 @@ private:
 	
 	CImg<float> div_G;
 	
+	/** the solver reads div_G stored in half precision */
+	bool half_precision;
+	
 	ImageUtil::BBox mask_bbox;
 	
 	
@@ -70,12 +75,15 @@ private:
 	 @brief	solves iteratively discrete Poisson Equation using Gauss-Seidel
 	 method.
 	 @param	input	the input image
-	 @param div_G	divergence of gradient vector field
+	 @param div_G	divergence of gradient vector field, planar with the size
+					of the input, float or Half, the rows are converted to
+					float by the kernel.
 	 @param output	the final image
 	 @param num_steps	the number of iterations of the computation.
 	 */
+	template <typename S>
 	void gaussSeidel(CImg<float> &input,
-					 CImg<float> &div_G,
+					 const S *div_G,
 					 CImg<float> &output,
 					 float tolerance,
 					 bool display_calculation = false);
@@ -144,8 +152,19 @@ public:
 				stitch_img to be used for stitching with the input_img.
 				Pixels with black color (0) in red channel are not used,
 				other pixels are used.
+	 @param		half_precision	store the divergence read by the solver in
+				every iteration in half precision, which halves its memory
+				traffic.
+	 */
+	GradientStitcher(string input_path, string stitch_path, string mask_path,
+					 bool half_precision = false);
+	
+	/**
+	 @brief		Same as above for images which are loaded already, e.g.
+				from the image cache or the result of other operation.
 	 */
-	GradientStitcher(string input_path, string stitch_path, string mask_path);
+	GradientStitcher(const CImg<float> &input, const CImg<float> &stitch,
+					 const CImg<float> &mask, bool half_precision = false);
 
 	
 	
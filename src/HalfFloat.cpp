@@ -0,0 +1,83 @@
+//
+//  HalfFloat.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "HalfFloat.h"
+
+// without -mf16c the F16C paths are compiled for the instruction set and
+// selected at runtime
+#if defined(__F16C__) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#define HALF_FLOAT_F16C
+#include <immintrin.h>
+#endif
+
+#ifdef HALF_FLOAT_F16C
+
+#ifndef __F16C__
+__attribute__((target("f16c")))
+#endif
+static int toHalfF16C(const float * src, Half * dst, int count)
+{
+	int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i h = _mm_cvtps_ph(_mm_loadu_ps(src + x), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storel_epi64((__m128i *)(dst + x), h);
+	}
+	return x;
+}
+
+#ifndef __F16C__
+__attribute__((target("f16c")))
+#endif
+static int toFloatF16C(const Half * src, float * dst, int count)
+{
+	int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i h = _mm_loadl_epi64((const __m128i *)(src + x));
+		_mm_storeu_ps(dst + x, _mm_cvtph_ps(h));
+	}
+	return x;
+}
+
+static bool hasF16C()
+{
+#ifdef __F16C__
+	return true;
+#else
+	static const bool supported = __builtin_cpu_supports("f16c");
+	return supported;
+#endif
+}
+
+#endif
+
+void HalfFloat::toHalf(const float * src, Half * dst, int count)
+{
+	int x = 0;
+#ifdef HALF_FLOAT_F16C
+	if (hasF16C())
+		x = toHalfF16C(src, dst, count);
+#endif
+	for (; x < count; ++x)
+	{
+		dst[x] = fromFloat(src[x]);
+	}
+}
+
+void HalfFloat::toFloat(const Half * src, float * dst, int count)
+{
+	int x = 0;
+#ifdef HALF_FLOAT_F16C
+	if (hasF16C())
+		x = toFloatF16C(src, dst, count);
+#endif
+	for (; x < count; ++x)
+	{
+		dst[x] = toFloat(src[x]);
+	}
+}
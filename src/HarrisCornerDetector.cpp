@@ -8,119 +8,382 @@
 
 #include "HarrisCornerDetector.h"
 
-using namespace Eigen;
-void HarrisCornerDetector::detect(cimg_library::CImg<unsigned char> &src,
-								  int treshold)
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+template <typename T>
+void HarrisCornerDetector::detect(cimg_library::CImg<T> &src,
+								  int treshold, ResponseType type)
 {
 	if (treshold == -1)
 		treshold = 10000;
 	
 	int width = src.width();
-	int height = src.height();
-	cimg_library::CImg<unsigned char> gray1(width,height,src.depth(),1);
-	//to greyscale
-	unsigned char r, g, b, gr1 = 0;
-	for (int y = 0; y < height; ++y)
+	PooledPlane<T> gray(width, src.height());
+	ImageView<T> image = gray.view();
+	ColorConversion::rgbToLuma(src, image);
+	
+	response(image, [&](int y, const float *R)
 	{
 		for (int x = 0; x < width; ++x)
 		{
-			r = src(x,y,0,0); // First channel RED
-			g = src(x,y,0,1); // Second channel GREEN
-			b = src(x,y,0,2); // Third channel BLUE
-			
-			gr1 = round(0.299*((double)r) + 0.587*((double)g) + 0.114*((double)b));
-			gray1(x,y,0,0) = gr1;
+			if (R[x] > treshold)
+			{
+				src(x, y, 0, 0) = PixelTraits<T>::max();
+			}
 		}
-	}
-	
-	Image image;
-	image.data = gray1.data(0, 0);
-	image.width = width;
-	image.height = height;
-	
-	
-	float kernel[2] = {-1, 1};
-	float *der_x = (float *)malloc(sizeof(float) * image.width * image.height);
-	float *der_y = (float *)malloc(sizeof(float) * image.width * image.height);
-	Convolution::convolve1D(image, der_x, 2, kernel, DIR_HORIZ);
-	Convolution::convolve1D(image, der_y, 2, kernel, DIR_VERT);
-	
-	float *Ixx = (float *)malloc(sizeof(float) * image.width * image.height);
-	float *Ixy = (float *)malloc(sizeof(float) * image.width * image.height);
-	float *Iyy = (float *)malloc(sizeof(float) * image.width * image.height);
-	
+	}, 0, -1, type);
+}
+
+template <typename T>
+std::vector<Keypoint> HarrisCornerDetector::detectKeypoints(cimg_library::CImg<T> &src,
+															float threshold, int nms_radius,
+															ResponseType type, bool subpixel)
+{
+	PooledPlane<T> gray(src.width(), src.height());
+	ImageView<T> image = gray.view();
+	ColorConversion::rgbToLuma(src, image);
+	return detectKeypoints(image, threshold, nms_radius, type, subpixel);
+}
+
+template <typename T>
+std::vector<Keypoint> HarrisCornerDetector::detectKeypoints(ImageView<T> &gray, float threshold,
+															int nms_radius, ResponseType type,
+															bool subpixel)
+{
+	PooledBuffer<float> R((size_t)gray.width * gray.height);
+	response(gray, R.data(), type);
+	std::vector<Keypoint> keypoints = nonMaxSuppression(R.data(), gray.width, gray.height,
+														nms_radius, threshold);
+	if (subpixel)
+		refineSubpixel(R.data(), gray.width, gray.height, keypoints);
+	return keypoints;
+}
+
+std::vector<Keypoint> HarrisCornerDetector::detectKeypointsStreaming(GrayRowSource source,
+																	 int width, int height,
+																	 float threshold, int nms_radius,
+																	 int strip_height, ResponseType type)
+{
+	if (nms_radius < 0)
+		throw std::runtime_error("Radius of the non-maximum suppression can not be negative.");
+	if (strip_height <= 0)
+		throw std::runtime_error("Strip height has to be positive.");
+	//response of row y needs gray rows y - 3 .. y + 2, the suppression
+	//of row y needs response rows y - nms_radius .. y + nms_radius
+	int halo_top = nms_radius + 3;
+	int halo_bottom = nms_radius + 2;
+	PooledBuffer<unsigned char> gray((size_t)(strip_height + halo_top + halo_bottom) * width);
+	PooledBuffer<float> R((size_t)(strip_height + 2 * nms_radius) * width);
 	
-	int i = 0;
-	float derx, dery;
-	for (int i = 0; i < image.height * image.width; ++i)
+	std::vector<Keypoint> keypoints;
+	//gray rows <g0, g1) are in the buffer
+	int g0 = 0;
+	int g1 = 0;
+	for (int y0 = 0; y0 < height; y0 += strip_height)
 	{
-		derx = der_x[i];
-		dery = der_y[i];
-		Ixx[i] = derx * derx;
-		Ixy[i] = derx * dery;
-		Iyy[i] = dery * dery;
+		int y1 = std::min(y0 + strip_height, height);
+		int need0 = std::max(y0 - halo_top, 0);
+		int need1 = std::min(y1 + halo_bottom, height);
+		if (need0 > g0)
+		{
+			memmove(gray.data(), gray.data() + (size_t)(need0 - g0) * width,
+					(size_t)(g1 - need0) * width);
+			g0 = need0;
+		}
+		source(g1, need1 - g1, gray.data() + (size_t)(g1 - g0) * width);
+		g1 = need1;
+		
+		Image strip(gray.data(), width, g1 - g0);
+		
+		int r0 = std::max(y0 - nms_radius, 0);
+		int r1 = std::min(y1 + nms_radius, height);
+		float *out = R.data();
+		response(strip, [=](int y, const float *row)
+		{
+			std::copy(row, row + width, out + (size_t)(y + g0 - r0) * width);
+		}, r0 - g0, r1 - g0, type);
+		
+		std::vector<Keypoint> found = nonMaxSuppression(R.data(), width, r1 - r0,
+														nms_radius, threshold);
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			found[i].y += r0;
+			if (found[i].y >= y0 && found[i].y < y1)
+				keypoints.push_back(found[i]);
+		}
 	}
+	return keypoints;
+}
+
+std::vector<Keypoint> HarrisCornerDetector::nonMaxSuppression(const float * R, int width, int height,
+															  int radius, float threshold)
+{
+	if (radius < 0)
+		throw std::runtime_error("Radius of the non-maximum suppression can not be negative.");
 	
-	Imagef imIxx;
-	imIxx.data = Ixx;
-	imIxx.width = image.width;
-	imIxx.height = image.height;
+	int window = 2 * radius + 1;
+	//keypoints found by each thread, keyed by the first row of its range
+	std::map<int, std::vector<Keypoint> > parts;
+	std::mutex parts_mutex;
 	
-	Imagef imIxy;
-	imIxy.data = Ixy;
-	imIxy.width = image.width;
-	imIxy.height = image.height;
+	Parallel::forRange(0, height, [&](int from, int to)
+	{
+		//horizontal maxima of the rows from - radius .. to + radius,
+		//row r is stored at (r mod window)
+		std::vector<float> hmax((size_t)window * width);
+		std::vector<float> vmax(width);
+		std::vector<Keypoint> found;
+		
+		auto horizontalMax = [&](int r)
+		{
+			const float *row = R + (size_t)r * width;
+			float *out = &hmax[(size_t)(r % window) * width];
+			for (int x = 0; x < width; ++x)
+			{
+				int x1 = std::max(x - radius, 0);
+				int x2 = std::min(x + radius, width - 1);
+				float m = row[x1];
+				for (int s = x1 + 1; s <= x2; ++s)
+				{
+					m = std::max(m, row[s]);
+				}
+				out[x] = m;
+			}
+		};
+		
+		int next = std::max(from - radius, 0);
+		for (int y = from; y < to; ++y)
+		{
+			for (; next <= std::min(y + radius, height - 1); ++next)
+			{
+				horizontalMax(next);
+			}
+			int y1 = std::max(y - radius, 0);
+			int y2 = std::min(y + radius, height - 1);
+			std::copy(&hmax[(size_t)(y1 % window) * width],
+					  &hmax[(size_t)(y1 % window) * width] + width, vmax.begin());
+			for (int t = y1 + 1; t <= y2; ++t)
+			{
+				const float *row = &hmax[(size_t)(t % window) * width];
+				for (int x = 0; x < width; ++x)
+				{
+					vmax[x] = std::max(vmax[x], row[x]);
+				}
+			}
+			const float *row = R + (size_t)y * width;
+			for (int x = 0; x < width; ++x)
+			{
+				if (row[x] > threshold && row[x] >= vmax[x])
+				{
+					found.push_back(Keypoint(x, y, row[x]));
+				}
+			}
+		}
+		
+		std::lock_guard<std::mutex> lock(parts_mutex);
+		parts[from].swap(found);
+	}, 64);
 	
-	Imagef imIyy;
-	imIyy.data = Iyy;
-	imIyy.width = image.width;
-	imIyy.height = image.height;
+	std::vector<Keypoint> keypoints;
+	for (std::map<int, std::vector<Keypoint> >::iterator it = parts.begin();
+		 it != parts.end(); ++it)
+	{
+		keypoints.insert(keypoints.end(), it->second.begin(), it->second.end());
+	}
+	return keypoints;
+}
+
+void HarrisCornerDetector::refineSubpixel(const float * R, int width, int height,
+										  std::vector<Keypoint> &keypoints)
+{
+	for (size_t i = 0; i < keypoints.size(); ++i)
+	{
+		Keypoint &kp = keypoints[i];
+		int x = (int)kp.x;
+		int y = (int)kp.y;
+		if (x < 1 || y < 1 || x >= width - 1 || y >= height - 1)
+			continue;
+		
+		const float *r0 = R + (size_t)(y - 1) * width + x;
+		const float *r1 = R + (size_t)y * width + x;
+		const float *r2 = R + (size_t)(y + 1) * width + x;
+		float dx = (r1[1] - r1[-1]) * 0.5f;
+		float dy = (r2[0] - r0[0]) * 0.5f;
+		float dxx = r1[1] - 2 * r1[0] + r1[-1];
+		float dyy = r2[0] - 2 * r1[0] + r0[0];
+		float dxy = (r2[1] - r2[-1] - r0[1] + r0[-1]) * 0.25f;
+		
+		//maximum of the fit needs negative definite hessian
+		float det = dxx * dyy - dxy * dxy;
+		if (dxx >= 0 || det <= 0)
+			continue;
+		float ox = -(dyy * dx - dxy * dy) / det;
+		float oy = -(dxx * dy - dxy * dx) / det;
+		if (std::fabs(ox) > 1 || std::fabs(oy) > 1)
+			continue;
+		
+		kp.x = x + ox;
+		kp.y = y + oy;
+		kp.response = r1[0] + 0.5f * (dx * ox + dy * oy);
+	}
+}
+
+template <typename T>
+void HarrisCornerDetector::response(ImageView<T> &gray, ResponseSink sink, int y_begin, int y_end,
+									ResponseType type)
+{
+	assert(gray.contiguousRows());
+	if (y_end < 0)
+		y_end = gray.height;
 	
+	Parallel::forRange(y_begin, y_end, [&](int from, int to)
+	{
+		responseRange(gray, sink, from, to, type);
+	}, 64);
+}
+
+template <typename T>
+void HarrisCornerDetector::response(ImageView<T> &gray, float * R, ResponseType type)
+{
+	int width = gray.width;
+	response(gray, [=](int y, const float *row)
+	{
+		std::copy(row, row + width, R + (size_t)y * width);
+	}, 0, -1, type);
+}
+
+template <typename T>
+void HarrisCornerDetector::responseRange(ImageView<T> &gray, ResponseSink &sink, int y_begin, int y_end,
+										 ResponseType type)
+{
+	//derivatives in the units of 8 bit images, 1 for unsigned char
+	const float range = 255.0f / PixelTraits<T>::max();
+	int width = gray.width;
+	int height = gray.height;
 	
+	//derivative kernel {-1, 1}, the same as convolve1D(Image &, ...)
+	float derivative[2] = {-1, 1};
 	float ker[5];
 	GaussianSampler::gaussian1D(0.0, 1.0, 5, ker);
 	
-	//convolve with larger gaussian
-	//xx
-	Convolution::convolve1D(imIxx, Ixx, 5, ker, DIR_HORIZ);
-	Convolution::convolve1D(imIxx, Ixx, 5, ker, DIR_VERT);
+	//the gaussian of row y needs the products of rows y - 2 .. y + 2 and the
+	//vertical derivative of a row needs the row above, the rows outside of
+	//<y_begin, y_end) only fill the ring buffers of the vertical stages
+	int first = std::max(y_begin - 3, 0);
+	int last = std::min(y_end + 2, height);
 	
-	//xy
-	Convolution::convolve1D(imIxy, Ixy, 5, ker, DIR_HORIZ);
-	Convolution::convolve1D(imIxy, Ixy, 5, ker, DIR_VERT);
+	//the gray row is pushed twice, x derivative in channel 0, y in channel 1
+	ConvolutionPipeline pipeline(width, 2);
+	pipeline.addHorizontal(derivative, 2, 0, 0, 1);
+	pipeline.addVertical(derivative, 2, 0, 1, 1);
 	
-	//yy
-	Convolution::convolve1D(imIyy, Iyy, 5, ker, DIR_HORIZ);
-	Convolution::convolve1D(imIyy, Iyy, 5, ker, DIR_VERT);
+	//Ixx, Ixy, Iyy
+	pipeline.addMap(3, [](const float *in, float *out, int w)
+	{
+		const float *der_x = in;
+		const float *der_y = in + w;
+		for (int x = 0; x < w; ++x)
+		{
+			out[x] = der_x[x] * der_x[x];
+			out[x + w] = der_x[x] * der_y[x];
+			out[x + 2 * w] = der_y[x] * der_y[x];
+		}
+	});
 	
+	//gaussian centered at the pixel
+	pipeline.addHorizontal(ker, 5, 2);
+	pipeline.addVertical(ker, 5, 2);
+	
+	PooledBuffer<float> R(width);
+	pipeline.addSink([&](int i, const float *tensor)
+	{
+		int y = first + i;
+		if (y < y_begin || y >= y_end)
+			return;
+		if (type == SHI_TOMASI)
+			shiTomasiRow(tensor, tensor + width, tensor + 2 * width, R.data(), width);
+		else
+			harrisRow(tensor, tensor + width, tensor + 2 * width, R.data(), width);
+		sink(y, R.data());
+	});
 	
-	MatrixXf A(2, 2);
-	float R, tr;
-	float k = 0.00001;
-	for (int y = 0; y < image.height; ++y)
+	PooledBuffer<float> row(2 * width);
+	for (int y = first; y < last; ++y)
 	{
-		for (int x = 0; x < image.width; ++x)
+		const T *in = gray.row(y);
+		for (int x = 0; x < width; ++x)
 		{
-			i = y * image.width + x;
-			A(0, 0) = Ixx[i];
-			A(0, 1) = Ixy[i];
-			A(1, 0) = Ixy[i];
-			A(1, 1) = Iyy[i];
-			
-			tr = A.trace();
-			R = A.determinant() - k * tr*tr;
-			
-			if (R > treshold)
-			{
-				src(x, y, 0, 0) = 255;
-			}
+			row[x] = row[x + width] = (float)in[x] * range;
 		}
+		pipeline.push(row.data());
+	}
+	pipeline.finish();
+}
+
+void HarrisCornerDetector::harrisRow(const float * Ixx, const float * Ixy, const float * Iyy,
+									 float * R, int width)
+{
+	const float k = HARRIS_K;
+	int x = 0;
+#ifdef __SSE2__
+	const __m128 vk = _mm_set1_ps(k);
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 xx = _mm_loadu_ps(Ixx + x);
+		__m128 xy = _mm_loadu_ps(Ixy + x);
+		__m128 yy = _mm_loadu_ps(Iyy + x);
+		__m128 tr = _mm_add_ps(xx, yy);
+		__m128 det = _mm_sub_ps(_mm_mul_ps(xx, yy), _mm_mul_ps(xy, xy));
+		_mm_storeu_ps(R + x, _mm_sub_ps(det, _mm_mul_ps(vk, _mm_mul_ps(tr, tr))));
+	}
+#endif
+	for (; x < width; ++x)
+	{
+		float tr = Ixx[x] + Iyy[x];
+		R[x] = (Ixx[x] * Iyy[x] - Ixy[x] * Ixy[x]) - k * (tr * tr);
+	}
+}
+
+void HarrisCornerDetector::shiTomasiRow(const float * Ixx, const float * Ixy, const float * Iyy,
+										float * R, int width)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 xx = _mm_loadu_ps(Ixx + x);
+		__m128 xy = _mm_loadu_ps(Ixy + x);
+		__m128 yy = _mm_loadu_ps(Iyy + x);
+		__m128 mean = _mm_mul_ps(_mm_add_ps(xx, yy), half);
+		__m128 diff = _mm_mul_ps(_mm_sub_ps(xx, yy), half);
+		__m128 root = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(diff, diff), _mm_mul_ps(xy, xy)));
+		_mm_storeu_ps(R + x, _mm_sub_ps(mean, root));
+	}
+#endif
+	for (; x < width; ++x)
+	{
+		float mean = (Ixx[x] + Iyy[x]) * 0.5f;
+		float diff = (Ixx[x] - Iyy[x]) * 0.5f;
+		R[x] = mean - std::sqrt(diff * diff + Ixy[x] * Ixy[x]);
 	}
-	
-	//free memory
-	free(der_x);
-	free(der_y);
-	free(Ixx);
-	free(Ixy);
-	free(Iyy);
 }
+
+#define HARRIS_INSTANTIATE(T) \
+template void HarrisCornerDetector::detect<T>(cimg_library::CImg<T> &, int, ResponseType); \
+template std::vector<Keypoint> HarrisCornerDetector::detectKeypoints<T>(cimg_library::CImg<T> &, float, int, \
+																		ResponseType, bool); \
+template std::vector<Keypoint> HarrisCornerDetector::detectKeypoints<T>(ImageView<T> &, float, int, \
+																		ResponseType, bool); \
+template void HarrisCornerDetector::response<T>(ImageView<T> &, ResponseSink, int, int, ResponseType); \
+template void HarrisCornerDetector::response<T>(ImageView<T> &, float *, ResponseType);
+
+HARRIS_INSTANTIATE(unsigned char)
+HARRIS_INSTANTIATE(unsigned short)
+HARRIS_INSTANTIATE(float)
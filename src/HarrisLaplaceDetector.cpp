@@ -0,0 +1,244 @@
+//
+//  HarrisLaplaceDetector.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "HarrisLaplaceDetector.h"
+
+#include <cstring>
+#include <stdexcept>
+
+HarrisLaplaceDetector::HarrisLaplaceDetector(int octaves, float log_threshold)
+:octaves(octaves), log_threshold(log_threshold), level_count(0)
+{
+	if (octaves <= 0)
+		throw std::runtime_error("Number of octaves has to be positive.");
+}
+
+Image HarrisLaplaceDetector::Level::view()
+{
+	return Image(image->data(), width, height);
+}
+
+std::vector<Keypoint> HarrisLaplaceDetector::detect(cimg_library::CImg<unsigned char> &src,
+													float threshold, int nms_radius,
+													HarrisCornerDetector::ResponseType type)
+{
+	cimg_library::CImg<unsigned char> gray1;
+	ColorConversion::rgbToLuma(src, gray1);
+	
+	Image image = Image::fromCImg(gray1);
+	return detect(image, threshold, nms_radius, type);
+}
+
+std::vector<Keypoint> HarrisLaplaceDetector::detect(Image &gray, float threshold, int nms_radius,
+													HarrisCornerDetector::ResponseType type)
+{
+	buildPyramid(gray);
+	return detectLevels(threshold, nms_radius, type);
+}
+
+std::vector<Keypoint> HarrisLaplaceDetector::detect(ImagePyramid &pyramid, float threshold, int nms_radius,
+													HarrisCornerDetector::ResponseType type)
+{
+	buildPyramid(pyramid);
+	return detectLevels(threshold, nms_radius, type);
+}
+
+std::vector<Keypoint> HarrisLaplaceDetector::detectLevels(float threshold, int nms_radius,
+														  HarrisCornerDetector::ResponseType type)
+{
+	//levels are independent, the response and suppression of each level
+	//run in their own thread
+	Parallel::forRange(0, level_count, [&](int from, int to)
+	{
+		for (int l = from; l < to; ++l)
+		{
+			Level &level = levels[l];
+			Image img = level.view();
+			PooledBuffer<float> response((size_t)level.width * level.height);
+			HarrisCornerDetector::response(img, response.data(), type);
+			level.keypoints = HarrisCornerDetector::nonMaxSuppression(response.data(),
+																	  level.width, level.height,
+																	  nms_radius, threshold);
+		}
+	});
+	
+	//characteristic scale, the Laplacian of the smoothed level is already
+	//scale normalized in the level pixels
+	std::vector<Keypoint> keypoints;
+	for (int l = 0; l < level_count; ++l)
+	{
+		float step = (float)(1 << l);
+		const std::vector<Keypoint> &found = levels[l].keypoints;
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			float x = found[i].x;
+			float y = found[i].y;
+			float lap = laplacian(l, x, y);
+			if (lap <= log_threshold)
+				continue;
+			if (l > 0 && laplacian(l - 1, 2 * x, 2 * y) > lap)
+				continue;
+			if (l + 1 < level_count && laplacian(l + 1, x / 2, y / 2) > lap)
+				continue;
+			keypoints.push_back(Keypoint(x * step, y * step, found[i].response, step));
+		}
+	}
+	return keypoints;
+}
+
+void HarrisLaplaceDetector::buildPyramid(Image &gray)
+{
+	if ((int)levels.size() < octaves)
+		levels.resize(octaves);
+	
+	int width = gray.width;
+	int height = gray.height;
+	level_count = 0;
+	for (int l = 0; l < octaves; ++l)
+	{
+		if (l > 0 && (width < HL_MIN_LEVEL_SIZE || height < HL_MIN_LEVEL_SIZE))
+			break;
+		resizeLevel(l, width, height);
+		++level_count;
+		width /= 2;
+		height /= 2;
+	}
+	
+	for (unsigned int y = 0; y < gray.height; ++y)
+	{
+		memcpy(levels[0].image->data() + (size_t)y * gray.width, gray.row(y), gray.width);
+	}
+	for (int l = 0; l < level_count; ++l)
+	{
+		smoothLevel(l, l + 1 < level_count);
+	}
+}
+
+void HarrisLaplaceDetector::buildPyramid(ImagePyramid &pyramid)
+{
+	if ((int)levels.size() < octaves)
+		levels.resize(octaves);
+	
+	level_count = 0;
+	for (int l = 0; l < std::min(octaves, pyramid.levelCount()); ++l)
+	{
+		const cimg_library::CImg<float> &src = pyramid.level(l);
+		if (l > 0 && (src.width() < HL_MIN_LEVEL_SIZE || src.height() < HL_MIN_LEVEL_SIZE))
+			break;
+		resizeLevel(l, src.width(), src.height());
+		++level_count;
+		
+		//luma with the weights of ColorConversion, the levels are not in
+		//<0, 1>, so the float version of rgbToLuma() does not apply
+		Level &level = levels[l];
+		size_t plane = level.image->size();
+		const float *r = src.data();
+		const float *g = src.spectrum() < 3 ? r : r + plane;
+		const float *b = src.spectrum() < 3 ? r : r + 2 * plane;
+		const double scale = 1.0 / (1 << LUMA_FRAC_BITS);
+		for (size_t i = 0; i < plane; ++i)
+		{
+			double v = LUMA_WEIGHT_R * (double)r[i] + LUMA_WEIGHT_G * (double)g[i] + LUMA_WEIGHT_B * (double)b[i];
+			(*level.image)[i] = PixelTraits<unsigned char>::round(v * scale);
+		}
+	}
+	
+	//the levels are subsampled already, only the smoothed planes are needed
+	for (int l = 0; l < level_count; ++l)
+	{
+		smoothLevel(l, false);
+	}
+}
+
+void HarrisLaplaceDetector::resizeLevel(int l, int width, int height)
+{
+	Level &level = levels[l];
+	size_t size = (size_t)width * height;
+	level.width = width;
+	level.height = height;
+	if (level.image && level.image->size() == size)
+		return;
+	//the previous planes go back to the pool first, so that they can serve
+	//this request
+	level.image.reset();
+	level.smooth.reset();
+	level.image = std::make_shared<PooledBuffer<unsigned char> >(size);
+	level.smooth = std::make_shared<PooledBuffer<float> >(size);
+}
+
+void HarrisLaplaceDetector::smoothLevel(int l, bool next)
+{
+	Level &level = levels[l];
+	int width = level.width;
+	int height = level.height;
+	
+	float ker[5];
+	GaussianSampler::gaussian1D(0.0, 1.0, 5, ker);
+	
+	//horizontally smoothed rows
+	PooledBuffer<float> horiz((size_t)width * height);
+	
+	Parallel::forRange(0, height, [&](int from, int to)
+	{
+		std::vector<float> row(width);
+		for (int y = from; y < to; ++y)
+		{
+			const unsigned char *in = level.image->data() + (size_t)y * width;
+			for (int x = 0; x < width; ++x)
+			{
+				row[x] = in[x];
+			}
+			Convolution::convolveRow(row.data(), horiz.data() + (size_t)y * width, width, 5, ker, 2);
+		}
+	}, 64);
+	
+	Parallel::forRange(0, height, [&](int from, int to)
+	{
+		const float *rows[5];
+		for (int y = from; y < to; ++y)
+		{
+			for (int t = 0; t < 5; ++t)
+			{
+				int r = std::min(std::max(y + 2 - t, 0), height - 1);
+				rows[t] = horiz.data() + (size_t)r * width;
+			}
+			Convolution::combineRows(rows, level.smooth->data() + (size_t)y * width, width, 5, ker);
+		}
+	}, 64);
+	
+	if (!next)
+		return;
+	
+	Level &coarse = levels[l + 1];
+	Parallel::forRange(0, coarse.height, [&](int from, int to)
+	{
+		for (int y = from; y < to; ++y)
+		{
+			const float *in = level.smooth->data() + (size_t)2 * y * width;
+			unsigned char *out = coarse.image->data() + (size_t)y * coarse.width;
+			for (int x = 0; x < coarse.width; ++x)
+			{
+				out[x] = (unsigned char)std::min(in[2 * x] + 0.5f, 255.0f);
+			}
+		}
+	}, 64);
+}
+
+float HarrisLaplaceDetector::laplacian(int l, float fx, float fy) const
+{
+	const Level &level = levels[l];
+	int w = level.width;
+	int h = level.height;
+	int x = std::min(std::max((int)(fx + 0.5f), 0), w - 1);
+	int y = std::min(std::max((int)(fy + 0.5f), 0), h - 1);
+	const float *s = level.smooth->data();
+	float c = s[(size_t)y * w + x];
+	float lap = s[(size_t)y * w + std::max(x - 1, 0)] + s[(size_t)y * w + std::min(x + 1, w - 1)]
+			  + s[(size_t)std::max(y - 1, 0) * w + x] + s[(size_t)std::min(y + 1, h - 1) * w + x]
+			  - 4 * c;
+	return std::fabs(lap);
+}
@@ -0,0 +1,149 @@
+//
+//  ImageCache.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "ImageCache.h"
+
+#include <cctype>
+#include <sys/stat.h>
+
+ImageCache::ImageCache()
+{
+	counters.hits = 0;
+	counters.misses = 0;
+}
+
+ImageCache &ImageCache::global()
+{
+	static ImageCache cache;
+	return cache;
+}
+
+ImageCache::FileStamp ImageCache::fileStamp(const std::string &path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	FileStamp stamp;
+	stamp.mtime = st.st_mtime;
+	stamp.size = st.st_size;
+	return stamp;
+}
+
+void ImageCache::decode(const std::string &path, int scale, Entry &entry)
+{
+	if (RawImage::isRaw(path))
+	{
+		entry.raw.reset(new RawImage(path));
+		entry.type = entry.raw->pixelType();
+	}
+	else
+	{
+		//JPEG is 8 bit, sampleMax() reports 255 for it
+		double max = sampleMax(path);
+		entry.type = max <= 255 ? RAW_U8 : (max <= 65535 ? RAW_U16 : RAW_F32);
+	}
+	switch (entry.type)
+	{
+		case RAW_U8:
+			decode(path, scale, entry, entry.u8);
+			break;
+		case RAW_U16:
+			decode(path, scale, entry, entry.u16);
+			break;
+		default:
+			decode(path, scale, entry, entry.f32);
+			break;
+	}
+}
+
+bool ImageCache::isJpeg(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	unsigned char soi[3];
+	bool jpeg = fread(soi, 1, 3, f) == 3 && soi[0] == 0xFF && soi[1] == 0xD8 && soi[2] == 0xFF;
+	fclose(f);
+	return jpeg;
+}
+
+void ImageCache::readFile(const std::string &path, std::vector<unsigned char> &data)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	size_t read = data.empty() ? 0 : fread(data.data(), 1, data.size(), f);
+	fclose(f);
+	if (read != data.size())
+		throw std::runtime_error("Unable to read " + path + ".");
+}
+
+double ImageCache::sampleMax(const std::string &path)
+{
+	if (RawImage::isRaw(path))
+		return RawImage::sampleMax(RawImage(path).pixelType());
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	unsigned char header[26];
+	size_t read = fread(header, 1, sizeof(header), f);
+	double max = 255;
+	if (read >= 2 && header[0] == 'P' && header[1] >= '1' && header[1] <= '6')
+	{
+		//width, height and maxval follow the magic, bitmaps have no maxval
+		if (header[1] == '1' || header[1] == '4')
+		{
+			max = 1;
+		}
+		else
+		{
+			fseek(f, 2, SEEK_SET);
+			int values[3] = {0, 0, 0};
+			for (int i = 0; i < 3; ++i)
+			{
+				int ch;
+				while ((ch = fgetc(f)) != EOF && (isspace(ch) || ch == '#'))
+				{
+					if (ch == '#')
+					{
+						while ((ch = fgetc(f)) != EOF && ch != '\n');
+					}
+				}
+				while (ch != EOF && isdigit(ch))
+				{
+					values[i] = values[i] * 10 + (ch - '0');
+					ch = fgetc(f);
+				}
+			}
+			if (values[2] > 0)
+				max = values[2];
+		}
+	}
+	else if (read >= 25 && header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G')
+	{
+		//bit depth of the IHDR chunk, lower depths are decoded as 8 bits
+		max = header[24] == 16 ? 65535 : 255;
+	}
+	fclose(f);
+	return max;
+}
+
+void ImageCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	cache.clear();
+}
+
+ImageCache::Stats ImageCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
@@ -0,0 +1,239 @@
+//
+//  ImagePyramid.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "ImagePyramid.h"
+
+#include <algorithm>
+
+#include "Parallel.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/**
+ Even elements p[0], p[2], p[4], p[6].
+ */
+static inline __m128 evens(const float * p)
+{
+	return _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+}
+#endif
+
+using namespace cimg_library;
+
+ImagePyramid::ImagePyramid(const CImg<float> &image, Filter filter, int max_levels, int min_size)
+:type(filter), built(1)
+{
+	assert(!image.is_empty() && image.depth() == 1);
+	int width = image.width();
+	int height = image.height();
+	int count = 1;
+	while ((max_levels <= 0 || count < max_levels) &&
+		   (width + 1) / 2 >= min_size && (height + 1) / 2 >= min_size)
+	{
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		++count;
+	}
+	gaussians.resize(count);
+	laplacians.resize(count);
+	gaussians[0].assign(image.data(), image.width(), image.height(), 1, image.spectrum(), true);
+}
+
+const CImg<float> & ImagePyramid::level(int l)
+{
+	assert(l >= 0 && l < levelCount());
+	std::lock_guard<std::mutex> lock(mutex);
+	for (; built <= l; ++built)
+	{
+		downsample(gaussians[built - 1], gaussians[built], type);
+	}
+	return gaussians[l];
+}
+
+const CImg<float> & ImagePyramid::laplacian(int l)
+{
+	assert(l >= 0 && l < levelCount());
+	const CImg<float> &fine = level(l);
+	if (l + 1 < levelCount())
+		level(l + 1);
+	std::lock_guard<std::mutex> lock(mutex);
+	CImg<float> &lap = laplacians[l];
+	if (lap.is_empty())
+	{
+		if (l + 1 == levelCount())
+		{
+			lap = fine;
+		}
+		else
+		{
+			expand(gaussians[l + 1], fine.width(), fine.height(), lap);
+			float *d = lap.data();
+			const float *f = fine.data();
+			size_t size = lap.size();
+			for (size_t i = 0; i < size; ++i)
+			{
+				d[i] = f[i] - d[i];
+			}
+		}
+	}
+	return lap;
+}
+
+void ImagePyramid::downsample(const CImg<float> &src, CImg<float> &dst, Filter filter)
+{
+	int width = src.width();
+	int height = src.height();
+	int out_width = (width + 1) / 2;
+	int out_height = (height + 1) / 2;
+	dst.assign(out_width, out_height, 1, src.spectrum());
+	for (int c = 0; c < src.spectrum(); ++c)
+	{
+		const float *in = src.data(0, 0, 0, c);
+		float *out = dst.data(0, 0, 0, c);
+		Parallel::forRange(0, out_height, [=](int from, int to)
+		{
+			std::vector<float> tmp(width + 8);
+			for (int y = from; y < to; ++y)
+			{
+				downsampleRow(in, width, height, y, filter, tmp.data(), out + (size_t)y * out_width, out_width);
+			}
+		}, 32);
+	}
+}
+
+void ImagePyramid::downsampleRow(const float * in, int width, int height, int y, Filter filter,
+								 float * tmp, float * out, int out_width)
+{
+	//vertical pass into tmp, which has two clamped samples before and
+	//after the row, the horizontal pass computes the even samples only
+	float *t = tmp + 2;
+	int x = 0;
+	if (filter == GAUSSIAN)
+	{
+		const float *r[5];
+		for (int k = 0; k < 5; ++k)
+		{
+			r[k] = in + (size_t)std::min(std::max(2 * y - 2 + k, 0), height - 1) * width;
+		}
+#ifdef __SSE2__
+		const __m128 four = _mm_set1_ps(4.0f);
+		const __m128 six = _mm_set1_ps(6.0f);
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128 outer = _mm_add_ps(_mm_loadu_ps(r[0] + x), _mm_loadu_ps(r[4] + x));
+			__m128 inner = _mm_add_ps(_mm_loadu_ps(r[1] + x), _mm_loadu_ps(r[3] + x));
+			__m128 v = _mm_add_ps(_mm_add_ps(outer, _mm_mul_ps(four, inner)),
+								  _mm_mul_ps(six, _mm_loadu_ps(r[2] + x)));
+			_mm_storeu_ps(t + x, v);
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			t[x] = ((r[0][x] + r[4][x]) + 4.0f * (r[1][x] + r[3][x])) + 6.0f * r[2][x];
+		}
+	}
+	else
+	{
+		const float *r0 = in + (size_t)(2 * y) * width;
+		const float *r1 = in + (size_t)std::min(2 * y + 1, height - 1) * width;
+#ifdef __SSE2__
+		for (; x + 4 <= width; x += 4)
+		{
+			_mm_storeu_ps(t + x, _mm_add_ps(_mm_loadu_ps(r0 + x), _mm_loadu_ps(r1 + x)));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			t[x] = r0[x] + r1[x];
+		}
+	}
+	t[-2] = t[-1] = t[0];
+	for (int k = 0; k < 6; ++k)
+	{
+		t[width + k] = t[width - 1];
+	}
+	
+	int i = 0;
+	if (filter == GAUSSIAN)
+	{
+		const float scale = 1.0f / 256.0f;
+#ifdef __SSE2__
+		const __m128 four = _mm_set1_ps(4.0f);
+		const __m128 six = _mm_set1_ps(6.0f);
+		const __m128 vscale = _mm_set1_ps(scale);
+		//the loads reach 2 * i + 9, which is within the padding of tmp
+		for (; i + 4 <= out_width; i += 4)
+		{
+			const float *p = t + 2 * i;
+			__m128 outer = _mm_add_ps(evens(p - 2), evens(p + 2));
+			__m128 inner = _mm_add_ps(evens(p - 1), evens(p + 1));
+			__m128 v = _mm_add_ps(_mm_add_ps(outer, _mm_mul_ps(four, inner)), _mm_mul_ps(six, evens(p)));
+			_mm_storeu_ps(out + i, _mm_mul_ps(v, vscale));
+		}
+#endif
+		for (; i < out_width; ++i)
+		{
+			const float *p = t + 2 * i;
+			out[i] = (((p[-2] + p[2]) + 4.0f * (p[-1] + p[1])) + 6.0f * p[0]) * scale;
+		}
+	}
+	else
+	{
+#ifdef __SSE2__
+		const __m128 quarter = _mm_set1_ps(0.25f);
+		for (; i + 4 <= out_width; i += 4)
+		{
+			const float *p = t + 2 * i;
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(evens(p), evens(p + 1)), quarter));
+		}
+#endif
+		for (; i < out_width; ++i)
+		{
+			out[i] = (t[2 * i] + t[2 * i + 1]) * 0.25f;
+		}
+	}
+}
+
+void ImagePyramid::expand(const CImg<float> &src, int width, int height, CImg<float> &dst)
+{
+	int sw = src.width();
+	int sh = src.height();
+	assert((width + 1) / 2 <= sw && (height + 1) / 2 <= sh);
+	dst.assign(width, height, 1, src.spectrum());
+	for (int c = 0; c < src.spectrum(); ++c)
+	{
+		const float *in = src.data(0, 0, 0, c);
+		float *out = dst.data(0, 0, 0, c);
+		Parallel::forRange(0, height, [=](int from, int to)
+		{
+			//the even rows are 1 6 1 / 8 of the coarse rows, the odd ones
+			//the average of two coarse rows, same horizontally
+			std::vector<float> row(sw);
+			for (int y = from; y < to; ++y)
+			{
+				int cy = y / 2;
+				const float *a = in + (size_t)std::max(cy - 1, 0) * sw;
+				const float *b = in + (size_t)cy * sw;
+				const float *d = in + (size_t)std::min(cy + 1, sh - 1) * sw;
+				for (int x = 0; x < sw; ++x)
+				{
+					row[x] = y & 1 ? 0.5f * (b[x] + d[x]) : 0.125f * (a[x] + 6.0f * b[x] + d[x]);
+				}
+				float *o = out + (size_t)y * width;
+				for (int x = 0; x < width; ++x)
+				{
+					int cx = x / 2;
+					float l = row[std::max(cx - 1, 0)];
+					float m = row[cx];
+					float r = row[std::min(cx + 1, sw - 1)];
+					o[x] = x & 1 ? 0.5f * (m + r) : 0.125f * (l + 6.0f * m + r);
+				}
+			}
+		}, 32);
+	}
+}
@@ -0,0 +1,94 @@
+//
+//  Keypoint.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "Keypoint.h"
+
+#include <cstring>
+
+static const char KEYPOINT_MAGIC[4] = {'K', 'P', 'T', 'S'};
+static const unsigned int KEYPOINT_VERSION = 1;
+
+void KeypointIO::save(const std::string &path, const std::vector<Keypoint> &keypoints)
+{
+	size_t len = path.size();
+	if (len >= 4 && path.compare(len - 4, 4, ".csv") == 0)
+	{
+		saveCSV(path, keypoints);
+	}
+	else
+	{
+		saveBinary(path, keypoints);
+	}
+}
+
+void KeypointIO::saveCSV(const std::string &path, const std::vector<Keypoint> &keypoints)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for writing.");
+	
+	fprintf(f, "x,y,response,scale\n");
+	for (size_t i = 0; i < keypoints.size(); ++i)
+	{
+		const Keypoint &kp = keypoints[i];
+		fprintf(f, "%g,%g,%g,%g\n", kp.x, kp.y, kp.response, kp.scale);
+	}
+	fclose(f);
+}
+
+void KeypointIO::saveBinary(const std::string &path, const std::vector<Keypoint> &keypoints)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for writing.");
+	
+	unsigned int count = (unsigned int)keypoints.size();
+	fwrite(KEYPOINT_MAGIC, 1, 4, f);
+	fwrite(&KEYPOINT_VERSION, sizeof(unsigned int), 1, f);
+	fwrite(&count, sizeof(unsigned int), 1, f);
+	for (size_t i = 0; i < keypoints.size(); ++i)
+	{
+		const Keypoint &kp = keypoints[i];
+		float rec[4] = {kp.x, kp.y, kp.response, kp.scale};
+		fwrite(rec, sizeof(float), 4, f);
+	}
+	fclose(f);
+}
+
+std::vector<Keypoint> KeypointIO::loadBinary(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	
+	char magic[4];
+	unsigned int version = 0;
+	unsigned int count = 0;
+	if (fread(magic, 1, 4, f) != 4 || memcmp(magic, KEYPOINT_MAGIC, 4) != 0 ||
+		fread(&version, sizeof(unsigned int), 1, f) != 1 ||
+		version != KEYPOINT_VERSION ||
+		fread(&count, sizeof(unsigned int), 1, f) != 1)
+	{
+		fclose(f);
+		throw std::runtime_error(path + " is not a keypoint file.");
+	}
+	
+	std::vector<Keypoint> keypoints;
+	keypoints.reserve(count);
+	float rec[4];
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (fread(rec, sizeof(float), 4, f) != 4)
+		{
+			fclose(f);
+			throw std::runtime_error(path + " is truncated.");
+		}
+		keypoints.push_back(Keypoint(rec[0], rec[1], rec[2], rec[3]));
+	}
+	fclose(f);
+	return keypoints;
+}
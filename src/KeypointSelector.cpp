@@ -0,0 +1,165 @@
+//
+//  KeypointSelector.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "KeypointSelector.h"
+
+#include <cmath>
+#include <limits>
+
+static bool strongerThan(const Keypoint &a, const Keypoint &b)
+{
+	return a.response > b.response;
+}
+
+std::vector<Keypoint> KeypointSelector::selectBucketed(const std::vector<Keypoint> &candidates,
+													   int width, int height, int total,
+													   int grid_cols, int grid_rows)
+{
+	int cells = grid_cols * grid_rows;
+	if (total <= 0 || cells <= 0)
+		return std::vector<Keypoint>();
+	
+	//counting sort of the candidates into the cells
+	std::vector<int> cell_of(candidates.size());
+	std::vector<int> start(cells + 1, 0);
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		int cx = std::min(std::max((int)(candidates[i].x * grid_cols / width), 0), grid_cols - 1);
+		int cy = std::min(std::max((int)(candidates[i].y * grid_rows / height), 0), grid_rows - 1);
+		cell_of[i] = cy * grid_cols + cx;
+		++start[cell_of[i] + 1];
+	}
+	for (int c = 0; c < cells; ++c)
+	{
+		start[c + 1] += start[c];
+	}
+	std::vector<Keypoint> bucketed(candidates.size());
+	std::vector<int> fill(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		bucketed[fill[cell_of[i]]++] = candidates[i];
+	}
+	
+	//strongest quota candidates of each cell
+	int quota = std::max(total / cells, 1);
+	std::vector<Keypoint> selected;
+	std::vector<Keypoint> rest;
+	selected.reserve(total);
+	for (int c = 0; c < cells; ++c)
+	{
+		std::vector<Keypoint>::iterator begin = bucketed.begin() + start[c];
+		std::vector<Keypoint>::iterator end = bucketed.begin() + start[c + 1];
+		if (end - begin > quota)
+		{
+			std::nth_element(begin, begin + quota, end, strongerThan);
+			rest.insert(rest.end(), begin + quota, end);
+			end = begin + quota;
+		}
+		selected.insert(selected.end(), begin, end);
+	}
+	
+	//budget left by sparse cells goes to the strongest remaining candidates,
+	//budget exceeded by too many cells is cut from the weakest selected
+	if ((int)selected.size() < total && !rest.empty())
+	{
+		size_t left = std::min((size_t)(total - selected.size()), rest.size());
+		std::nth_element(rest.begin(), rest.begin() + left, rest.end(), strongerThan);
+		selected.insert(selected.end(), rest.begin(), rest.begin() + left);
+	}
+	std::sort(selected.begin(), selected.end(), strongerThan);
+	if ((int)selected.size() > total)
+		selected.resize(total);
+	return selected;
+}
+
+std::vector<Keypoint> KeypointSelector::selectBucketed(const std::vector<Keypoint> &candidates,
+													   int width, int height, int total)
+{
+	double cells = std::max(total / 8.0, 1.0);
+	int cols = std::max((int)round(std::sqrt(cells * width / height)), 1);
+	int rows = std::max((int)round(cells / cols), 1);
+	return selectBucketed(candidates, width, height, total, cols, rows);
+}
+
+std::vector<Keypoint> KeypointSelector::selectANMS(const std::vector<Keypoint> &candidates,
+												   int width, int height, int total,
+												   float robust)
+{
+	size_t n = candidates.size();
+	if (total <= 0 || n == 0)
+		return std::vector<Keypoint>();
+	
+	std::vector<Keypoint> sorted(candidates);
+	std::sort(sorted.begin(), sorted.end(), strongerThan);
+	
+	//grid of the candidates inserted so far, about 2 candidates per cell
+	int cell = std::max((int)std::sqrt((double)width * height / (n / 2.0 + 1)), 1);
+	int grid_cols = width / cell + 1;
+	int grid_rows = height / cell + 1;
+	std::vector< std::vector<int> > grid(grid_cols * grid_rows);
+	
+	std::vector<float> radius(n);
+	size_t inserted = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		//insert all candidates sufficiently stronger than i
+		for (; inserted < i && sorted[inserted].response * robust > sorted[i].response; ++inserted)
+		{
+			int gx = std::min(std::max((int)sorted[inserted].x / cell, 0), grid_cols - 1);
+			int gy = std::min(std::max((int)sorted[inserted].y / cell, 0), grid_rows - 1);
+			grid[gy * grid_cols + gx].push_back(inserted);
+		}
+		
+		float best = std::numeric_limits<float>::max();
+		if (inserted > 0)
+		{
+			int gx = std::min(std::max((int)sorted[i].x / cell, 0), grid_cols - 1);
+			int gy = std::min(std::max((int)sorted[i].y / cell, 0), grid_rows - 1);
+			//search rings of cells around the candidate until no closer
+			//candidate can be found
+			for (int ring = 0; ring < std::max(grid_cols, grid_rows); ++ring)
+			{
+				float ring_dist = (float)((ring - 1) * cell);
+				if (ring > 0 && ring_dist * ring_dist > best)
+					break;
+				for (int y = gy - ring; y <= gy + ring; ++y)
+				{
+					if (y < 0 || y >= grid_rows)
+						continue;
+					for (int x = gx - ring; x <= gx + ring; ++x)
+					{
+						if (x < 0 || x >= grid_cols ||
+							(std::abs(x - gx) != ring && std::abs(y - gy) != ring))
+							continue;
+						const std::vector<int> &bucket = grid[y * grid_cols + x];
+						for (size_t j = 0; j < bucket.size(); ++j)
+						{
+							float dx = sorted[bucket[j]].x - sorted[i].x;
+							float dy = sorted[bucket[j]].y - sorted[i].y;
+							best = std::min(best, dx * dx + dy * dy);
+						}
+					}
+				}
+			}
+		}
+		radius[i] = best;
+	}
+	
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = i;
+	size_t count = std::min((size_t)total, n);
+	std::partial_sort(order.begin(), order.begin() + count, order.end(),
+					  [&](size_t a, size_t b) { return radius[a] > radius[b]; });
+	
+	std::vector<Keypoint> selected(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		selected[i] = sorted[order[i]];
+	}
+	return selected;
+}
@@ -0,0 +1,206 @@
+//
+//  LayoutConversion.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "LayoutConversion.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+//One riffle of the block of N registers: the bytes of the first half are
+//interleaved with the bytes of the second half, which moves byte p to
+//2p mod (16N - 1). Riffling 3 channel data five times (2^5 = 32 is the
+//inverse of 3 mod 95) and 4 channel data four times (16 is the inverse of
+//4 mod 63) sorts the bytes by channel.
+template <int N>
+static inline void riffle(__m128i *v)
+{
+	__m128i t[N];
+	for (int i = 0; i < N / 2; ++i)
+	{
+		t[2 * i] = _mm_unpacklo_epi8(v[i], v[i + N / 2]);
+		t[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i + N / 2]);
+	}
+	for (int i = 0; i < N; ++i)
+		v[i] = t[i];
+}
+
+//Inverse of riffle(), the even bytes go to the first half and the odd
+//bytes to the second half.
+template <int N>
+static inline void unriffle(__m128i *v)
+{
+	const __m128i low = _mm_set1_epi16(0x00ff);
+	__m128i t[N];
+	for (int i = 0; i < N / 2; ++i)
+	{
+		t[i] = _mm_packus_epi16(_mm_and_si128(v[2 * i], low),
+								_mm_and_si128(v[2 * i + 1], low));
+		t[i + N / 2] = _mm_packus_epi16(_mm_srli_epi16(v[2 * i], 8),
+										_mm_srli_epi16(v[2 * i + 1], 8));
+	}
+	for (int i = 0; i < N; ++i)
+		v[i] = t[i];
+}
+
+//32 RGB pixels, v[2c] and v[2c + 1] hold channel c
+static inline void deinterleave3(const unsigned char *src, __m128i *v)
+{
+	for (int i = 0; i < 6; ++i)
+		v[i] = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+	for (int i = 0; i < 5; ++i)
+		riffle<6>(v);
+}
+
+static inline void interleave3(__m128i *v, unsigned char *dst)
+{
+	for (int i = 0; i < 5; ++i)
+		unriffle<6>(v);
+	for (int i = 0; i < 6; ++i)
+		_mm_storeu_si128((__m128i *)(dst + 16 * i), v[i]);
+}
+
+//16 RGBA pixels, v[c] holds channel c
+static inline void deinterleave4(const unsigned char *src, __m128i *v)
+{
+	for (int i = 0; i < 4; ++i)
+		v[i] = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+	for (int i = 0; i < 4; ++i)
+		riffle<4>(v);
+}
+
+static inline void interleave4(__m128i *v, unsigned char *dst)
+{
+	for (int i = 0; i < 4; ++i)
+		unriffle<4>(v);
+	for (int i = 0; i < 4; ++i)
+		_mm_storeu_si128((__m128i *)(dst + 16 * i), v[i]);
+}
+#endif
+
+void LayoutConversion::interleavedToPlanar(const unsigned char * src, int channels,
+										   unsigned char * const * planes, int count)
+{
+	assert(channels == 3 || channels == 4);
+	int x = 0;
+#ifdef __SSE2__
+	__m128i v[6];
+	if (channels == 3)
+	{
+		for (; x + 32 <= count; x += 32)
+		{
+			deinterleave3(src + 3 * x, v);
+			for (int c = 0; c < 3; ++c)
+			{
+				_mm_storeu_si128((__m128i *)(planes[c] + x), v[2 * c]);
+				_mm_storeu_si128((__m128i *)(planes[c] + x + 16), v[2 * c + 1]);
+			}
+		}
+	}
+	else
+	{
+		for (; x + 16 <= count; x += 16)
+		{
+			deinterleave4(src + 4 * x, v);
+			for (int c = 0; c < 4; ++c)
+				_mm_storeu_si128((__m128i *)(planes[c] + x), v[c]);
+		}
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		for (int c = 0; c < channels; ++c)
+			planes[c][x] = src[channels * x + c];
+	}
+}
+
+void LayoutConversion::planarToInterleaved(const unsigned char * const * planes, int channels,
+										   unsigned char * dst, int count)
+{
+	assert(channels == 3 || channels == 4);
+	int x = 0;
+#ifdef __SSE2__
+	__m128i v[6];
+	if (channels == 3)
+	{
+		for (; x + 32 <= count; x += 32)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				v[2 * c] = _mm_loadu_si128((const __m128i *)(planes[c] + x));
+				v[2 * c + 1] = _mm_loadu_si128((const __m128i *)(planes[c] + x + 16));
+			}
+			interleave3(v, dst + 3 * x);
+		}
+	}
+	else
+	{
+		for (; x + 16 <= count; x += 16)
+		{
+			for (int c = 0; c < 4; ++c)
+				v[c] = _mm_loadu_si128((const __m128i *)(planes[c] + x));
+			interleave4(v, dst + 4 * x);
+		}
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		for (int c = 0; c < channels; ++c)
+			dst[channels * x + c] = planes[c][x];
+	}
+}
+
+void LayoutConversion::rgbToRgba(const unsigned char * rgb, unsigned char * rgba, int count,
+								 unsigned char alpha)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i a = _mm_set1_epi8((char)alpha);
+	__m128i v[6];
+	for (; x + 32 <= count; x += 32)
+	{
+		deinterleave3(rgb + 3 * x, v);
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i p[4] = {v[half], v[2 + half], v[4 + half], a};
+			interleave4(p, rgba + 4 * (x + 16 * half));
+		}
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		rgba[4 * x] = rgb[3 * x];
+		rgba[4 * x + 1] = rgb[3 * x + 1];
+		rgba[4 * x + 2] = rgb[3 * x + 2];
+		rgba[4 * x + 3] = alpha;
+	}
+}
+
+void LayoutConversion::rgbaToRgb(const unsigned char * rgba, unsigned char * rgb, int count)
+{
+	int x = 0;
+#ifdef __SSE2__
+	__m128i v[6];
+	__m128i p[4];
+	for (; x + 32 <= count; x += 32)
+	{
+		for (int half = 0; half < 2; ++half)
+		{
+			deinterleave4(rgba + 4 * (x + 16 * half), p);
+			v[half] = p[0];
+			v[2 + half] = p[1];
+			v[4 + half] = p[2];
+		}
+		interleave3(v, rgb + 3 * x);
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		rgb[3 * x] = rgba[4 * x];
+		rgb[3 * x + 1] = rgba[4 * x + 1];
+		rgb[3 * x + 2] = rgba[4 * x + 2];
+	}
+}
@@ -0,0 +1,79 @@
+//
+//  PnmReader.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "PnmReader.h"
+
+#include <cctype>
+
+PnmReader::PnmReader(const std::string &path)
+:f(NULL), path(path), w(0), h(0), c(0), next_row(0)
+{
+	f = fopen(path.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	
+	char magic[2];
+	if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+	{
+		fclose(f);
+		throw std::runtime_error(path + " is not a binary PGM or PPM image.");
+	}
+	c = magic[1] == '5' ? 1 : 3;
+	w = headerValue();
+	h = headerValue();
+	int maxval = headerValue();
+	if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255)
+	{
+		fclose(f);
+		throw std::runtime_error(path + ": only 8 bit PGM and PPM images are supported.");
+	}
+	//single whitespace separates the header from the samples, it was
+	//consumed by headerValue()
+}
+
+PnmReader::~PnmReader()
+{
+	if (f)
+		fclose(f);
+}
+
+int PnmReader::headerValue()
+{
+	int ch = fgetc(f);
+	while (ch != EOF && (isspace(ch) || ch == '#'))
+	{
+		if (ch == '#')
+		{
+			while (ch != EOF && ch != '\n')
+				ch = fgetc(f);
+		}
+		ch = fgetc(f);
+	}
+	int value = -1;
+	if (ch != EOF && isdigit(ch))
+	{
+		value = 0;
+		while (ch != EOF && isdigit(ch))
+		{
+			value = value * 10 + (ch - '0');
+			ch = fgetc(f);
+		}
+	}
+	return value;
+}
+
+void PnmReader::readRows(unsigned char * out, int count)
+{
+	if (count <= 0)
+		return;
+	if (next_row + count > h)
+		throw std::runtime_error(path + ": reading past the last row.");
+	size_t size = (size_t)count * w * c;
+	if (fread(out, 1, size, f) != size)
+		throw std::runtime_error(path + " is truncated.");
+	next_row += count;
+}
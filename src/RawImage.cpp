@@ -0,0 +1,181 @@
+//
+//  RawImage.cpp
+//  kimproc
+//
+//  Created by Jan Brejcha on 19.10.26.
+//
+
+#include "RawImage.h"
+#include "PixelTraits.h"
+
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char RAW_MAGIC[4] = {'K', 'R', 'A', 'W'};
+
+RawImage::RawImage()
+:fd(-1), writable(false), map(NULL), map_size(0)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+RawImage::RawImage(const std::string &path, bool writable)
+:fd(-1), writable(false), map(NULL), map_size(0)
+{
+	memset(&header, 0, sizeof(header));
+	open(path, writable);
+}
+
+RawImage::~RawImage()
+{
+	close();
+}
+
+size_t RawImage::sampleSize(RawPixelType type)
+{
+	switch (type)
+	{
+		case RAW_U8:
+			return 1;
+		case RAW_U16:
+			return 2;
+		case RAW_F32:
+			return 4;
+	}
+	return 0;
+}
+
+double RawImage::sampleMax(RawPixelType type)
+{
+	switch (type)
+	{
+		case RAW_U8:
+			return PixelTraits<unsigned char>::max();
+		case RAW_U16:
+			return PixelTraits<unsigned short>::max();
+		case RAW_F32:
+			return PixelTraits<float>::max();
+	}
+	return 0;
+}
+
+bool RawImage::isRaw(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	char magic[4];
+	bool raw = fread(magic, 1, 4, f) == 4 && memcmp(magic, RAW_MAGIC, 4) == 0;
+	fclose(f);
+	return raw;
+}
+
+void RawImage::open(const std::string &path, bool writable)
+{
+	close();
+	this->path = path;
+	fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open " + path + " for reading.");
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+		memcmp(header.magic, RAW_MAGIC, 4) != 0 || header.version != RAW_VERSION)
+	{
+		close();
+		throw std::runtime_error(path + " is not a raw image.");
+	}
+	//the dimensions are used as int and the tile offsets are computed in
+	//size_t, everything is validated against the file size first
+	uint64_t data_size = 0;
+	if (header.width == 0 || header.height == 0 || header.channels == 0 ||
+		header.width > INT_MAX || header.height > INT_MAX || header.channels > INT_MAX ||
+		header.tile_width == 0 || header.tile_height == 0 ||
+		header.tile_width > header.width || header.tile_height > header.height ||
+		sampleSize(pixelType()) == 0 || header.layout > RAW_INTERLEAVED ||
+		header.data_offset < sizeof(RawHeader) || header.data_offset > (uint64_t)st.st_size ||
+		!dataSize(data_size) || data_size > (uint64_t)st.st_size - header.data_offset ||
+		(uint64_t)st.st_size > SIZE_MAX)
+	{
+		close();
+		throw std::runtime_error(path + " is corrupted or truncated.");
+	}
+	map_size = st.st_size;
+	mapFile(writable);
+}
+
+bool RawImage::dataSize(uint64_t &bytes) const
+{
+	//tilesX() and tilesY() do not overflow for dimensions up to INT_MAX
+	uint64_t factors[5] = {(uint64_t)tilesX() * tilesY(), header.tile_width, header.tile_height,
+		header.channels, sampleSize(pixelType())};
+	bytes = 1;
+	for (int i = 0; i < 5; ++i)
+	{
+		if (factors[i] != 0 && bytes > UINT64_MAX / factors[i])
+			return false;
+		bytes *= factors[i];
+	}
+	return true;
+}
+
+void RawImage::create(const std::string &path, int width, int height, int channels, RawPixelType type,
+					  RawLayout layout, int tile_width, int tile_height)
+{
+	assert(width > 0 && height > 0 && channels > 0);
+	close();
+	this->path = path;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RAW_MAGIC, 4);
+	header.version = RAW_VERSION;
+	header.width = width;
+	header.height = height;
+	header.channels = channels;
+	header.type = type;
+	header.layout = layout;
+	header.tile_width = tile_width > 0 ? std::min(tile_width, width) : width;
+	header.tile_height = tile_height > 0 ? std::min(tile_height, height) : height;
+	header.data_offset = RAW_DATA_OFFSET;
+	
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open " + path + " for writing.");
+	map_size = header.data_offset + (size_t)tilesX() * tilesY() * tileBytes();
+	if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+		ftruncate(fd, map_size) != 0)
+	{
+		close();
+		throw std::runtime_error("Unable to write " + path + ".");
+	}
+	mapFile(true);
+}
+
+void RawImage::mapFile(bool writable)
+{
+	//read only images are mapped copy on write, the pages are shared with
+	//the page cache until a kernel writes to them
+	void *m = mmap(NULL, map_size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+	{
+		close();
+		throw std::runtime_error("Unable to map " + path + ".");
+	}
+	map = (unsigned char *)m;
+	this->writable = writable;
+}
+
+void RawImage::close()
+{
+	if (map)
+		munmap(map, map_size);
+	if (fd >= 0)
+		::close(fd);
+	map = NULL;
+	map_size = 0;
+	fd = -1;
+	writable = false;
+}
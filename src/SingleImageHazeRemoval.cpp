@@ -9,41 +9,46 @@
 #include "SingleImageHazeRemoval.h"
 
 #define CLOCK_PER_MS CLOCKS_PER_SEC/1000.0
-SingleImageHazeRemoval::SingleImageHazeRemoval(CImg<unsigned char> &image, std::string _output_name)
-: input_image(image), output_name(_output_name)
+template <typename T>
+SingleImageHazeRemoval<T>::SingleImageHazeRemoval(CImg<T> &image, std::string _output_name,
+												  bool half_precision)
+: input_image(image), layered(image), output_name(_output_name), half_precision(half_precision)
 {
-	dark_channel = CImg<unsigned char>(image.width(), image.height(), 1, 1);
+	dark_channel = CImg<T>(image.width(), image.height(), 1, 1);
 }
 
 /**
  Entry method that runs dehazing process
  */
-void SingleImageHazeRemoval::dehaze()
+template <typename T>
+CImg<T> SingleImageHazeRemoval<T>::dehaze()
 {
-	darkChannel<unsigned char>(input_image, dark_channel);
-	dark_channel.save((output_name + "_darkChannel.png").c_str());
-	Eigen::Vector3i atm = atmosphericLight();
+	darkChannel(layered.template viewFor<SingleImageHazeRemoval>(), dark_channel);
+	save(dark_channel, "_darkChannel.png");
+	Eigen::Vector3d atm = atmosphericLight();
 	
 	transmissionEstimate(atm);
 	
-	CImg<unsigned char> rad_est(input_image.width(), input_image.height(), 1, 3);
+	CImg<T> rad_est(input_image.width(), input_image.height(), 1, 3);
 	getRadiance(atm, transEst, rad_est);
-	rad_est.save((output_name + "_radEst.png").c_str());
+	save(rad_est, "_radEst.png");
 	
-	CImg<unsigned char> trans = matte();
-	trans.save((output_name + "_trans.png").c_str());
-	CImg<unsigned char> rad(input_image.width(), input_image.height(), 1, 3);
+	CImg<T> trans = matte();
+	save(trans, "_trans.png");
+	CImg<T> rad(input_image.width(), input_image.height(), 1, 3);
 	getRadiance(atm, trans, rad);
-	rad.save((output_name + "_rad.png").c_str());
+	save(rad, "_rad.png");
 
-	CImg<unsigned char> depth = depthMap(trans);
+	CImg<T> depth = depthMap(trans);
 	depth.save((output_name + "_depth.png").c_str());
+	return rad;
 }
 
 /**
  Calculation of atmospheric light from darkChannel
  */
-Eigen::Vector3i SingleImageHazeRemoval::atmosphericLight()
+template <typename T>
+Eigen::Vector3d SingleImageHazeRemoval<T>::atmosphericLight()
 {
 	int w = input_image.width();
 	int h = input_image.height();
@@ -52,76 +57,115 @@ Eigen::Vector3i SingleImageHazeRemoval::atmosphericLight()
 	int pixels_2 = pixels * 2;
 	//take 0.1% of all pixels
 	int numpx = (int)floor((double)pixels / 1000.0);
-	unsigned char *data = dark_channel.data();
-	unsigned char *im = input_image.data();
+	T *data = dark_channel.data();
+	T *im = input_image.data();
 	std::vector<int> idx = sort_indices(data, pixels);
 	
-	Eigen::Vector3i atm(0, 0, 0);
+	Eigen::Vector3d atm(0, 0, 0);
 	for (int i = pixels - 1; i >= pixels - numpx; --i)
 	{
 		int index = idx[i];
-		atm += Eigen::Vector3i(im[index], im[index + pixels], im[index + pixels_2]);
+		atm += Eigen::Vector3d(im[index], im[index + pixels], im[index + pixels_2]);
 	}
 	atm = atm / numpx;
+	if (PixelTraits<T>::is_integer)
+		atm = atm.array().floor();
 	
 	return atm;
 }
 
-void SingleImageHazeRemoval::transmissionEstimate(Eigen::Vector3i atmLight)
+template <typename T>
+void SingleImageHazeRemoval<T>::transmissionEstimate(Eigen::Vector3d atmLight)
+{
+	if (half_precision)
+		estimateTransmission<Half>(atmLight);
+	else
+		estimateTransmission<float>(atmLight);
+}
+
+template <typename T>
+template <typename S>
+void SingleImageHazeRemoval<T>::estimateTransmission(Eigen::Vector3d atmLight)
 {
 	int w = input_image.width();
 	int h = input_image.height();
+	double range = PixelTraits<T>::max();
 	
-	//normalize input image by atmospheric light
-	CImg<double> normalized(w, h, 1, 3);
+	//minimum of the channels normalized by atmospheric light, the patch
+	//minimum of it is the dark channel of the normalized image
+	ImageView<T, 3, PreferredLayout> rgb = layered.template viewFor<SingleImageHazeRemoval>();
+	PooledBuffer<S> pixel_min((size_t)w * h);
+	PooledBuffer<S> patch_min((size_t)w * h);
+	PooledBuffer<float> row(w);
+	PooledBuffer<float> tmp(w);
 	for (int y = 0; y < h; ++y)
 	{
 		for (int x = 0; x < w; ++x)
 		{
-			normalized(x, y, 0, 0) = (double)input_image(x, y, 0, 0) / (double)atmLight.x();
-			normalized(x, y, 0, 1) = (double)input_image(x, y, 0, 1) / (double)atmLight.y();
-			normalized(x, y, 0, 2) = (double)input_image(x, y, 0, 2) / (double)atmLight.z();
+			row[x] = (float)std::min(std::min((double)rgb(x, y, 0) / atmLight.x(),
+											  (double)rgb(x, y, 1) / atmLight.y()),
+									 (double)rgb(x, y, 2) / atmLight.z());
 		}
+		HalfFloat::storeRow(row.data(), &pixel_min[(size_t)y * w], w);
 	}
-	CImg<double> _transEst = CImg<double>(w, h, 1, 1);
-	transEst = CImg<unsigned char>(w, h, 1, 1);
-	darkChannel<double>(normalized, _transEst);
 	
-	//find max
-	double maximum = 0.0;
-	double val;
+	//the patch <x, x + PATCH_SIZE) x <y, y + PATCH_SIZE) as in darkChannel(),
+	//separably, horizontal minimum first
 	for (int y = 0; y < h; ++y)
 	{
+		const float *in = HalfFloat::loadRow(&pixel_min[(size_t)y * w], tmp.data(), w);
 		for (int x = 0; x < w; ++x)
 		{
-			val = _transEst(x, y, 0, 0);
-			if (val > maximum)
-				maximum = val;
+			float m = in[x];
+			for (int px = x + 1; px < std::min(x + PATCH_SIZE, w); ++px)
+				m = std::min(m, in[px]);
+			row[x] = m;
+		}
+		HalfFloat::storeRow(row.data(), &patch_min[(size_t)y * w], w);
+	}
+	float maximum = 0.0f;
+	for (int y = 0; y < h; ++y)
+	{
+		const float *in = HalfFloat::loadRow(&patch_min[(size_t)y * w], tmp.data(), w);
+		std::copy(in, in + w, row.data());
+		for (int py = y + 1; py < std::min(y + PATCH_SIZE, h); ++py)
+		{
+			in = HalfFloat::loadRow(&patch_min[(size_t)py * w], tmp.data(), w);
+			for (int x = 0; x < w; ++x)
+				row[x] = std::min(row[x], in[x]);
 		}
+		for (int x = 0; x < w; ++x)
+			maximum = std::max(maximum, row[x]);
+		//the vertical minimum is not needed any more, pixel_min is reused
+		HalfFloat::storeRow(row.data(), &pixel_min[(size_t)y * w], w);
 	}
 	
-	_transEst = (maximum - 0.95 * _transEst);
+	transEst = CImg<T>(w, h, 1, 1);
 	for (int y = 0; y < h; ++y)
 	{
+		const float *dark = HalfFloat::loadRow(&pixel_min[(size_t)y * w], tmp.data(), w);
 		for (int x = 0; x < w; ++x)
 		{
-			transEst(x, y, 0, 0) = (unsigned char)floor((_transEst(x, y, 0, 0) / maximum) * 255.0);
+			transEst(x, y, 0, 0) = PixelTraits<T>::truncate(((maximum - 0.95 * dark[x]) / maximum) * range);
 		}
 	}
 }
 
-void SingleImageHazeRemoval::getRadiance(Eigen::Vector3i atmLight, CImg<unsigned char> &trans, CImg<unsigned char> &out_rad)
+template <typename T>
+void SingleImageHazeRemoval<T>::getRadiance(Eigen::Vector3d atmLight, CImg<T> &trans, CImg<T> &out_rad)
 {
 	int w = input_image.width();
 	int h = input_image.height();
+	double range = PixelTraits<T>::max();
 	
-	double ax = atmLight.x() / 255.0;
-	double ay = atmLight.y() / 255.0;
-	double az = atmLight.z() / 255.0;
+	double ax = atmLight.x() / range;
+	double ay = atmLight.y() / range;
+	double az = atmLight.z() / range;
 	double transmission;
 	double t;
 	
-	CImg<double> _out_rad(out_rad.width(), out_rad.height(), 1, 3);
+	PooledBuffer<double> rad_buffer((size_t)out_rad.width() * out_rad.height() * 3);
+	CImg<double> _out_rad(rad_buffer.data(), out_rad.width(), out_rad.height(), 1, 3, true);
 	double maxr = 0;
 	double maxg = 0;
 	double maxb = 0;
@@ -131,16 +175,17 @@ void SingleImageHazeRemoval::getRadiance(Eigen::Vector3i atmLight, CImg<unsigned
 	
 	double r, g, b;
 	
+	ImageView<T, 3, PreferredLayout> rgb = layered.template viewFor<SingleImageHazeRemoval>();
 	for (int y = 0; y < h; ++y)
 	{
 		for (int x = 0; x < w; ++x)
 		{
-			transmission = ((double)trans(x, y, 0, 0))/255.0;
+			transmission = ((double)trans(x, y, 0, 0))/range;
 			//std::cout << "trans: " << transmission << std::endl;
 			t = std::max(transmission, T0);
-			r = (((input_image(x, y, 0, 0) / 255.0) - ax)/t + ax);
-			g = (((input_image(x, y, 0, 1) / 255.0) - ay)/t + ay);
-			b = (((input_image(x, y, 0, 2) / 255.0) - az)/t + az);
+			r = (((rgb(x, y, 0) / range) - ax)/t + ax);
+			g = (((rgb(x, y, 1) / range) - ay)/t + ay);
+			b = (((rgb(x, y, 2) / range) - az)/t + az);
 			maxr = std::max(r, maxr);
 			maxg = std::max(g, maxg);
 			maxb = std::max(b, maxb);
@@ -160,28 +205,48 @@ void SingleImageHazeRemoval::getRadiance(Eigen::Vector3i atmLight, CImg<unsigned
 	{
 		for (int x = 0; x < w; ++x)
 		{
-			r = ((_out_rad(x, y, 0, 0) - minr) / maxr) * 255.0;
-			g = ((_out_rad(x, y, 0, 1)  - ming) / maxg) * 255.0;
-			b = ((_out_rad(x, y, 0, 2)  - minb) / maxb) * 255.0;
+			r = ((_out_rad(x, y, 0, 0) - minr) / maxr) * range;
+			g = ((_out_rad(x, y, 0, 1)  - ming) / maxg) * range;
+			b = ((_out_rad(x, y, 0, 2)  - minb) / maxb) * range;
 			r = r < 0 ? 0 : r;
 			g = g < 0 ? 0 : g;
 			b = b < 0 ? 0 : b;
-			out_rad(x, y, 0, 0) = (unsigned char)floor(r);
-			out_rad(x, y, 0, 1) = (unsigned char)floor(g);
-			out_rad(x, y, 0, 2) = (unsigned char)floor(b);
+			out_rad(x, y, 0, 0) = PixelTraits<T>::truncate(r);
+			out_rad(x, y, 0, 1) = PixelTraits<T>::truncate(g);
+			out_rad(x, y, 0, 2) = PixelTraits<T>::truncate(b);
 		}
 	}
 }
 
-CImg<double> SingleImageHazeRemoval::depthMap(CImg<unsigned char> &transmission)
+template <typename T>
+CImg<double> SingleImageHazeRemoval<T>::depthMap(CImg<T> &transmission)
 {
-	CImg<double> depth_map = CImg<double>(transmission);
+	//in 8 bit range whatever the pixel type
+	CImg<double> depth_map = CImg<double>(transmission) * (255.0 / PixelTraits<T>::max());
 	log(depth_map);
 	return depth_map;
 }
 
+template <typename T>
+void SingleImageHazeRemoval<T>::save(const CImg<T> &img, const std::string &suffix)
+{
+	std::string path = output_name + suffix;
+	if (PixelTraits<T>::is_integer)
+	{
+		img.save(path.c_str());
+		return;
+	}
+	CImg<unsigned char> out(img.width(), img.height(), img.depth(), img.spectrum());
+	for (size_t i = 0; i < img.size(); ++i)
+	{
+		out[i] = PixelTraits<unsigned char>::round(img[i] * 255.0);
+	}
+	out.save(path.c_str());
+}
 
-Eigen::MatrixXd SingleImageHazeRemoval::cov(Eigen::MatrixXd m)
+
+template <typename T>
+Eigen::MatrixXd SingleImageHazeRemoval<T>::cov(Eigen::MatrixXd m)
 {
 	m.transposeInPlace();
 	Eigen::MatrixXd centered = m.rowwise() - m.colwise().mean();
@@ -189,7 +254,8 @@ Eigen::MatrixXd SingleImageHazeRemoval::cov(Eigen::MatrixXd m)
 	return cov;
 }
 
-CImg<unsigned char> SingleImageHazeRemoval::matte()
+template <typename T>
+CImg<T> SingleImageHazeRemoval<T>::matte()
 {
 	int w = input_image.width();
 	int h = input_image.height();
@@ -205,8 +271,8 @@ CImg<unsigned char> SingleImageHazeRemoval::matte()
 	
 	int side = (window - 1) / 2;
 	
-	typedef Eigen::Triplet<double> T;
-	std::vector<T> tripletList;
+	typedef Eigen::Triplet<double> Triplet;
+	std::vector<Triplet> tripletList;
 	tripletList.reserve(2 * dim);
 	int lx, ly;
 	int j_s, i_s;
@@ -252,7 +318,7 @@ CImg<unsigned char> SingleImageHazeRemoval::matte()
 						
 							val = (k_dm - (inv_w_pixels * (one + var_f * w_inv_cov_id * var_s)));
 							
-							tripletList.push_back(T(lx, ly, val(0, 0)));
+							tripletList.push_back(Triplet(lx, ly, val(0, 0)));
 						}
 					}
 					
@@ -277,7 +343,7 @@ CImg<unsigned char> SingleImageHazeRemoval::matte()
 	cg.compute(A);
 	Eigen::MatrixXd matte_t = cg.solve(b);
 	
-	CImg<unsigned char> trans = vecToImg(matte_t, w, h);
+	CImg<T> trans = vecToImg(matte_t, w, h);
 	
 #ifdef TIME_DEBUG
 	end = clock();
@@ -287,7 +353,8 @@ CImg<unsigned char> SingleImageHazeRemoval::matte()
 	return trans;
 }
 
-CImg<unsigned char> SingleImageHazeRemoval::vecToImg(Eigen::MatrixXd &vec, int w, int h)
+template <typename T>
+CImg<T> SingleImageHazeRemoval<T>::vecToImg(Eigen::MatrixXd &vec, int w, int h)
 {
 	int dim = w * h;
 	if (dim != vec.size())
@@ -295,7 +362,7 @@ CImg<unsigned char> SingleImageHazeRemoval::vecToImg(Eigen::MatrixXd &vec, int w
 		throw std::runtime_error("This vector does not have right number of elements to fill image of this size.");
 	}
 	int x, y;
-	CImg<unsigned char> img(w, h, 1);
+	CImg<T> img(w, h, 1);
 	double val;
 	for (int i = 0; i < vec.size(); ++i)
 	{
@@ -303,14 +370,13 @@ CImg<unsigned char> SingleImageHazeRemoval::vecToImg(Eigen::MatrixXd &vec, int w
 		y = i / w;
 		//std::cout << vec(i) << std::endl;
 		val = vec(i);
-		val = val > 255.0 ? 255.0 : val;
-		val = val < 0.0 ? 0.0 : val;
-		img(x, y, 0, 0) = (unsigned char)floor(val);
+		img(x, y, 0, 0) = PixelTraits<T>::truncate(val);
 	}	
 	return img;
 }
 
-Eigen::MatrixXd SingleImageHazeRemoval::vecFromTransmission(CImg<unsigned char> &trans)
+template <typename T>
+Eigen::MatrixXd SingleImageHazeRemoval<T>::vecFromTransmission(CImg<T> &trans)
 {
 	int w = trans.width();
 	int h = trans.height();
@@ -329,7 +395,8 @@ Eigen::MatrixXd SingleImageHazeRemoval::vecFromTransmission(CImg<unsigned char>
 }
 
 
-Eigen::MatrixXd SingleImageHazeRemoval::windowFlatMatrix(CImg<unsigned char> &im, int window, int cx, int cy)
+template <typename T>
+Eigen::MatrixXd SingleImageHazeRemoval<T>::windowFlatMatrix(CImg<T> &im, int window, int cx, int cy)
 {
 	int side = (window - 1)/2;
 	int sx = cx - side;
@@ -337,15 +404,16 @@ Eigen::MatrixXd SingleImageHazeRemoval::windowFlatMatrix(CImg<unsigned char> &im
 	int maxx = sx + window;
 	int maxy = sy + window;
 	int dim = window * window;
+	double range = PixelTraits<T>::max();
 	Eigen::MatrixXd m(3, dim);
 	int ind = 0;
 	for (int i = sx; i < maxx; ++i)
 	{
 		for (int j = sy; j < maxy; ++j)
 		{
-			m(0, ind) = ((double)im(i, j, 0, 0))/255.0;
-			m(1, ind) = ((double)im(i, j, 0, 1))/255.0;
-			m(2, ind) = ((double)im(i, j, 0, 2))/255.0;
+			m(0, ind) = ((double)im(i, j, 0, 0))/range;
+			m(1, ind) = ((double)im(i, j, 0, 1))/range;
+			m(2, ind) = ((double)im(i, j, 0, 2))/range;
 			ind++;
 		}
 	}
@@ -353,25 +421,32 @@ Eigen::MatrixXd SingleImageHazeRemoval::windowFlatMatrix(CImg<unsigned char> &im
 	return m;
 }
 
-Eigen::SparseMatrix<double> SingleImageHazeRemoval::sparseDiagonal(int size, double val)
+template <typename T>
+Eigen::SparseMatrix<double> SingleImageHazeRemoval<T>::sparseDiagonal(int size, double val)
 {
 	Eigen::SparseMatrix<double> res(size, size);
-	typedef Eigen::Triplet<double> T;
-	std::vector<T> tripletList;
+	typedef Eigen::Triplet<double> Triplet;
+	std::vector<Triplet> tripletList;
 	for (int i = 0; i < size; ++i)
 	{
-		tripletList.push_back(T(i, i, val));
+		tripletList.push_back(Triplet(i, i, val));
 	}
 	res.setFromTriplets(tripletList.begin(), tripletList.end());
 	return res;
 }
 
-Eigen::MatrixXd SingleImageHazeRemoval::rgbVec(CImg<unsigned char> &im, int x, int y)
+template <typename T>
+Eigen::MatrixXd SingleImageHazeRemoval<T>::rgbVec(CImg<T> &im, int x, int y)
 {
+	double range = PixelTraits<T>::max();
 	Eigen::MatrixXd vec(3, 1);
-	vec(0, 0) = ((double)im(x, y, 0, 0)/255.0);
-	vec(1, 0) = ((double)im(x, y, 0, 1)/255.0);
-	vec(2, 0) = ((double)im(x, y, 0, 2)/255.0);
+	vec(0, 0) = ((double)im(x, y, 0, 0)/range);
+	vec(1, 0) = ((double)im(x, y, 0, 1)/range);
+	vec(2, 0) = ((double)im(x, y, 0, 2)/range);
 	
 	return vec;
 }
+
+template class SingleImageHazeRemoval<unsigned char>;
+template class SingleImageHazeRemoval<unsigned short>;
+template class SingleImageHazeRemoval<float>;
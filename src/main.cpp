@@ -19,14 +19,25 @@
 #include "main.h"
 
 #include "HarrisCornerDetector.h"
+#include "KeypointSelector.h"
+#include "HarrisLaplaceDetector.h"
+#include "ImagePyramid.h"
+#include "BriefDescriptor.h"
+#include "PnmReader.h"
+#include "RawImage.h"
+#include "TiledImage.h"
+#include "ImageCache.h"
+#include "CornerTracker.h"
 #include "SingleImageHazeRemoval.h"
 #include "GradientStitcher.h"
 
 #include "argumentparser.h"
 
 #include "CImg.h"
+#include <cctype>
 #include <cstdio>
 #include <vector>
+#include <memory>
 #include <iostream>
 #include <xlocale.h>
 
@@ -54,6 +65,75 @@ ArgumentParser buildArgumentParser(int argc, const char *argv[])
 
 	Argument harris("h", "harris", hpar, "Calculates harris corners and visualizes them as red dots in the output image.", true);
 
+	vector<Parameter> stpar;
+	stpar.push_back(Parameter("threshold", "threshold of the smaller eigenvalue of the structure tensor."));
+	Argument shiTomasi("st", "shi-tomasi", stpar, "Same as harris, but uses the Shi-Tomasi (min eigenvalue) corner response.", true);
+
+	vector<Parameter> kppar;
+	kppar.push_back(Parameter("threshold", "minimal harris response of the corner."));
+	kppar.push_back(Parameter("radius", "radius of the non-maximum suppression window, e.g. 1 for 3x3."));
+	kppar.push_back(Parameter("keypoint file", "Path of the keypoint list, CSV if it ends with .csv, binary otherwise."));
+	Argument keypoints("kp", "keypoints", kppar, "Detects harris corners with non-maximum suppression, saves them to <keypoint file> and visualizes them as red dots in the output image.", true);
+
+	vector<Parameter> bkpar;
+	bkpar.push_back(Parameter("count", "number of the selected corners."));
+	bkpar.push_back(Parameter("method", "grid - strongest corners of each grid cell, anms - adaptive non-maximal suppression."));
+	bkpar.push_back(Parameter("keypoint file", "Path of the keypoint list, CSV if it ends with .csv, binary otherwise."));
+	Argument bestKeypoints("bk", "best-keypoints", bkpar, "Selects <count> well distributed harris corners from all local maxima of the response, without any threshold.", true);
+
+	vector<Parameter> tkpar;
+	tkpar.push_back(Parameter("threshold", "minimal harris response of the corner."));
+	tkpar.push_back(Parameter("radius", "radius of the non-maximum suppression window."));
+	tkpar.push_back(Parameter("strip height", "number of rows processed at once."));
+	tkpar.push_back(Parameter("keypoint file", "Path of the keypoint list, CSV if it ends with .csv, binary otherwise."));
+	Argument tiledKeypoints("tk", "tiled-keypoints", tkpar, "Same as -kp for images larger than memory, the input has to be binary PGM or PPM, which is read in strips, or 8 bit raw image (.kraw) or 8 bit TIFF (with USE_TIFF), which are read by their tiles or strips through the tile cache. No output image is written.", true);
+
+	vector<Parameter> tcpar;
+	tcpar.push_back(Parameter("size", "memory budget of the tile cache in MB, 256 by default."));
+	Argument tileCache("tc", "tile-cache", tcpar, "Sets the memory budget of the tile cache used by -tk for raw and TIFF images, the least recently used tiles are evicted when it is exceeded.", true);
+
+	vector<Parameter> sqpar;
+	sqpar.push_back(Parameter("frame count", "number of the frames, the input image is a pattern of the frame path with a single %d for the frame index, e.g. frame%04d.png, %% is the percent sign."));
+	sqpar.push_back(Parameter("tracks file", "CSV file with the tracked corners, frame,id,x,y,age."));
+	Argument sequence("sq", "sequence", sqpar, "Tracks harris corners over the frame sequence by pyramidal Lucas-Kanade, new corners are detected on keyframes and in empty parts of the frame. The last frame with the tracked corners is saved to the output.", true);
+
+	vector<Parameter> mpar;
+	mpar.push_back(Parameter("second image", "Image to be matched with the input image."));
+	mpar.push_back(Parameter("count", "number of the corners selected in each image."));
+	mpar.push_back(Parameter("matches file", "CSV file with the matched corners, x1,y1,x2,y2,distance."));
+	Argument match("m", "match", mpar, "Matches Harris-Laplace corners of the input and the second image by oriented BRIEF descriptors.", true);
+
+	vector<Parameter> sppar;
+	Argument subpixel("sp", "subpixel", sppar, "Refines the corners of -kp and -bk to sub-pixel accuracy.", true);
+
+	vector<Parameter> ptpar;
+	ptpar.push_back(Parameter("type", "u8 (default), u16 for 16 bit data, e.g. 12 or 16 bit PNM, or f32 for float data in <0, 1>."));
+	Argument pixelType("pt", "pixel-type", ptpar, "Pixel type the input image is loaded as for -h, -st, -kp, -dh and -wr, which run natively on it without truncation to 8 bits. The samples are scaled from the range of the file (maxval of PNM, bit depth of PNG) to the range of the type and back when the result is saved.", true);
+
+	vector<Parameter> wrpar;
+	wrpar.push_back(Parameter("layout", "planar or interleaved."));
+	wrpar.push_back(Parameter("tile size", "width and height of the tiles, 0 for untiled image."));
+	Argument writeRaw("wr", "write-raw", wrpar, "Converts the input image to the raw container (.kraw), which is memory mapped instead of decoded when used as input, the image is saved to the output path. Only untiled planar images are used without a copy.", true);
+
+	vector<Parameter> hppar;
+	Argument halfPrecision("hp", "half-precision", hppar, "Stores the intermediate planes of -dh and -s in half precision (FP16), which halves their memory and bandwidth, the arithmetic stays float. Every pass converts the planes, so it pays off only for images whose planes do not fit the cache, smaller images get slower. The conversions use F16C if the CPU supports it and are several times slower without it.", true);
+
+	vector<Parameter> chpar;
+	Argument chain("ch", "chain", chpar, "Chains the operations, each processes the result of the previous one in the order -h, -st, -kp, -bk, -hl, -m, -sq, -dh, -s and only the last result is saved to the output, as raw image if -wr is given. Without chaining every operation processes the input image and saves its result, with _<operation> appended to the output name if several are given. The input is decoded only once in both cases.", true);
+
+	vector<Parameter> scpar;
+	scpar.push_back(Parameter("scale", "1 (default), 2, 4 or 8."));
+	Argument scale("sc", "scale", scpar, "Decodes the input images at 1 / scale of their size. JPEG images are decoded directly at the reduced size by the scaled IDCT of libjpeg, which is several times faster than decoding the full image, other images are averaged after decoding. -tk ignores the scale and always reads the full image.", true);
+
+	vector<Parameter> pspar;
+	Argument poolStats("ps", "pool-stats", pspar, "Prints hit and miss statistics of the buffer pool and of the image cache at the end.", true);
+
+	vector<Parameter> hlpar;
+	hlpar.push_back(Parameter("threshold", "minimal harris response of the corner on its pyramid level."));
+	hlpar.push_back(Parameter("octaves", "number of the pyramid levels."));
+	hlpar.push_back(Parameter("keypoint file", "Path of the keypoint list, CSV if it ends with .csv, binary otherwise."));
+	Argument harrisLaplace("hl", "harris-laplace", hlpar, "Detects multi-scale Harris-Laplace corners over a gaussian pyramid, the keypoint scale is the characteristic scale of the corner.", true);
+
 	vector<Parameter> dpar;
 	Argument dehaze("dh", "dehaze-HST09", dpar, "Implements article: Single Image Haze Removal Using Dark Channel Prior by He, Sun, Tung from CVPR 09.", true);
 	
@@ -75,26 +155,377 @@ ArgumentParser buildArgumentParser(int argc, const char *argv[])
 	ap.addArgument(input);
 	ap.addArgument(output);
 	ap.addArgument(harris);
+	ap.addArgument(shiTomasi);
+	ap.addArgument(keypoints);
+	ap.addArgument(bestKeypoints);
+	ap.addArgument(harrisLaplace);
+	ap.addArgument(subpixel);
+	ap.addArgument(pixelType);
+	ap.addArgument(writeRaw);
+	ap.addArgument(halfPrecision);
+	ap.addArgument(chain);
+	ap.addArgument(scale);
+	ap.addArgument(poolStats);
+	ap.addArgument(match);
+	ap.addArgument(tiledKeypoints);
+	ap.addArgument(tileCache);
+	ap.addArgument(sequence);
 	ap.addArgument(dehaze);
 	ap.addArgument(stitch);
 
 	return ap;
 }
 
-void png16test(const char *input_image)
+/**
+ Pixel type of the images loaded for -h, -st, -kp, -dh and -wr.
+ */
+enum PixelType
 {
-    cimg_library::CImg<int> src(input_image);
-    for (int y = 0; y < src.height(); ++y)
+	PIXEL_U8,
+	PIXEL_U16,
+	PIXEL_F32
+};
+
+PixelType parsePixelType(const string &name)
+{
+	if (name == "u8")
+		return PIXEL_U8;
+	if (name == "u16")
+		return PIXEL_U16;
+	if (name == "f32")
+		return PIXEL_F32;
+	throw std::runtime_error("Unknown pixel type " + name + ", use u8, u16 or f32.");
+}
+
+int parseScale(const string &value)
+{
+	int scale = atoi(value.c_str());
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+		throw std::runtime_error("Unsupported scale " + value + ", use 1, 2, 4 or 8.");
+	return scale;
+}
+
+/**
+ Path of the frame of a sequence, the pattern holds exactly one integer
+ conversion %d or %i with optional 0 or - flag and width, e.g.
+ frame%04d.png, and %% for the percent sign. The pattern is never passed to
+ printf, other conversions are rejected.
+ */
+string framePath(const string &pattern, int frame)
+{
+	string path;
+	int conversions = 0;
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		if (pattern[i] != '%')
+		{
+			path += pattern[i];
+			continue;
+		}
+		size_t begin = i++;
+		if (i < pattern.size() && pattern[i] == '%')
+		{
+			path += '%';
+			continue;
+		}
+		while (i < pattern.size() && (pattern[i] == '0' || pattern[i] == '-'))
+			++i;
+		size_t digits = i;
+		while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+			++i;
+		if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i') || i - digits > 3)
+			throw std::runtime_error("Unsupported conversion in the frame pattern " + pattern +
+									 ", use a single %d, e.g. frame%04d.png.");
+		//the conversion was validated, so it is a safe format
+		char number[64];
+		snprintf(number, sizeof(number), (pattern.substr(begin, i - begin) + "d").c_str(), frame);
+		path += number;
+		++conversions;
+	}
+	if (conversions != 1)
+		throw std::runtime_error("The frame pattern " + pattern +
+								 " has to contain exactly one %d, e.g. frame%04d.png.");
+	return path;
+}
+
+/**
+ Converts the samples of src multiplied by scale to the pixel type of dst,
+ rounded and clamped to its range.
+ */
+template <typename S, typename T>
+void convertRange(const cimg_library::CImg<S> &src, double scale, cimg_library::CImg<T> &dst)
+{
+	dst.assign(src.width(), src.height(), src.depth(), src.spectrum());
+	for (size_t i = 0; i < src.size(); ++i)
+	{
+		dst[i] = PixelTraits<T>::round(src[i] * scale);
+	}
+}
+
+/**
+ Saves the image, paths ending with .kraw are written as raw images in the
+ pixel type range. Other images are written with samples in <0, sample_max>,
+ e.g. the maxval of the input image, as 8 bit if it fits, as 16 bit
+ otherwise.
+ */
+template <typename T>
+void saveImage(cimg_library::CImg<T> &img, const string &path, double sample_max)
+{
+	size_t len = path.size();
+	double scale = sample_max / PixelTraits<T>::max();
+	if (len >= 5 && path.compare(len - 5, 5, ".kraw") == 0)
+	{
+		RawImage::write(path, img);
+	}
+	else if (PixelTraits<T>::is_integer && scale == 1)
+	{
+		img.save(path.c_str());
+	}
+	else if (sample_max <= PixelTraits<unsigned char>::max())
+	{
+		cimg_library::CImg<unsigned char> out;
+		convertRange(img, scale, out);
+		out.save(path.c_str());
+	}
+	else
+	{
+		cimg_library::CImg<unsigned short> out;
+		convertRange(img, scale, out);
+		out.save(path.c_str());
+	}
+}
+
+/**
+ Input and output of the image operations. The input is decoded once by
+ the image cache, however many operations use it. Without chaining every
+ operation processes the input image and saves its result, with the
+ operation name appended to the output path when several operations are
+ requested, e.g. out_h.png. Chained operations process the result of the
+ previous operation instead, only the last result is saved to the output
+ path. The images are decoded at 1 / scale of their size.
+ 
+ The operations get their image in the range of the pixel type (see
+ PixelTraits), e.g. a 12 bit PNM requested as u16 is scaled from 4095 to
+ 65535 and an 8 bit image requested as f32 to <0, 1>. The results are
+ scaled back to the range of the input file on saving.
+ */
+class ImageChain
+{
+public:
+	ImageChain(const string &input_path, const string &output_path, bool chained, int operations,
+			   int scale = 1)
+	:input_path(input_path), output_path(output_path), chained(chained),
+	operations(operations), decode_scale(scale), input_max(-1), raw_layout(RAW_PLANAR),
+	raw_tile_size(-1), current_type(RAW_U8)
+	{
+	}
+	
+	/**
+	 Copies the input of the next operation into img, scaled to the range
+	 of T, the result of the previous operation is scaled from the range of
+	 its type.
+	 */
+	template <typename T>
+	void input(cimg_library::CImg<T> &img)
+	{
+		if (chained && !current.is_empty())
+		{
+			convertRange(current, PixelTraits<T>::max() / RawImage::sampleMax(current_type), img);
+			return;
+		}
+		if (input_max < 0)
+			input_max = ImageCache::sampleMax(input_path);
+		if (input_max == PixelTraits<T>::max())
+			img.assign(ImageCache::global().get<T>(input_path, decode_scale), false);
+		else
+			convertRange(ImageCache::global().get<float>(input_path, decode_scale),
+						 PixelTraits<T>::max() / input_max, img);
+	}
+	
+	/**
+	 Copies the input of the next operation into img with samples in
+	 <0, sample_max>, for operations which combine it with other images in
+	 their own range, e.g. the stitcher.
+	 */
+	void input(cimg_library::CImg<float> &img, double sample_max)
+	{
+		if (chained && !current.is_empty())
+		{
+			img.assign(current);
+			img *= sample_max / RawImage::sampleMax(current_type);
+			return;
+		}
+		if (input_max < 0)
+			input_max = ImageCache::sampleMax(input_path);
+		img.assign(ImageCache::global().get<float>(input_path, decode_scale), false);
+		if (input_max != sample_max)
+			img *= sample_max / input_max;
+	}
+	
+	/**
+	 Gaussian pyramid of the input of the next operation in the range of
+	 unsigned char, built once and shared by the operations which run on
+	 the same input.
+	 */
+	ImagePyramid &pyramid()
 	{
-		for (int x = 0; x < src.width(); ++x)
+		if (!input_pyramid)
 		{
-			float r = src(x,y,0,0); // First channel RED
-            std::cout << r << ", ";
-        }
-        std::cout << std::endl;
-    }
+			input(pyramid_base, PixelTraits<unsigned char>::max());
+			input_pyramid.reset(new ImagePyramid(pyramid_base));
+		}
+		return *input_pyramid;
+	}
+	
+	/**
+	 Result of the operation of the given short name.
+	 */
+	template <typename T>
+	void output(cimg_library::CImg<T> &img, const string &operation)
+	{
+		if (chained)
+		{
+			current.assign(img);
+			current_type = RawPixelTypeOf<T>::value;
+			//the next operation runs on the new result
+			input_pyramid.reset();
+		}
+		else
+		{
+			saveImage(img, outputPath(operation), outputMax<T>());
+		}
+	}
+	
+	/**
+	 Writes the input as raw image, chained operations write their last
+	 result as raw image by finish().
+	 */
+	template <typename T>
+	void writeRaw(RawLayout layout, int tile_size)
+	{
+		raw_layout = layout;
+		raw_tile_size = tile_size;
+		if (chained)
+			return;
+		cimg_library::CImg<T> src;
+		input(src);
+		RawImage::write(outputPath("wr"), src, layout, tile_size, tile_size);
+	}
+	
+	/**
+	 Saves the result of the chained operations, in the pixel type of the
+	 last one. If no operation produced a result, e.g. only -wr is given,
+	 the input is saved in the pixel type T.
+	 */
+	template <typename T>
+	void finish()
+	{
+		if (!chained || operations == 0)
+			return;
+		if (current.is_empty())
+		{
+			cimg_library::CImg<T> src;
+			input(src);
+			save(src);
+		}
+		else if (current_type == RAW_U16)
+			save(cimg_library::CImg<unsigned short>(current));
+		else if (current_type == RAW_F32)
+			save(current);
+		else
+			save(cimg_library::CImg<unsigned char>(current));
+	}
+	
+private:
+	
+	template <typename T>
+	void save(const cimg_library::CImg<T> &img)
+	{
+		cimg_library::CImg<T> result(img, false);
+		if (raw_tile_size >= 0)
+			RawImage::write(output_path, result, raw_layout, raw_tile_size, raw_tile_size);
+		else
+			saveImage(result, output_path, outputMax<T>());
+	}
+	
+	/**
+	 Maximal sample value of the saved images, the one of the input file,
+	 at least 8 bits, e.g. for float raw input. 8 bits for float results if
+	 the input was not read.
+	 */
+	template <typename T>
+	double outputMax() const
+	{
+		if (input_max > 0)
+			return std::max(input_max, (double)PixelTraits<unsigned char>::max());
+		return PixelTraits<T>::is_integer ? PixelTraits<T>::max() : PixelTraits<unsigned char>::max();
+	}
+	
+	string outputPath(const string &operation) const
+	{
+		if (operations <= 1)
+			return output_path;
+		size_t dot = output_path.rfind('.');
+		size_t slash = output_path.rfind('/');
+		if (dot == string::npos || (slash != string::npos && dot < slash))
+			return output_path + "_" + operation;
+		return output_path.substr(0, dot) + "_" + operation + output_path.substr(dot);
+	}
+	
+	string input_path;
+	string output_path;
+	bool chained;
+	/** number of the requested operations with image output */
+	int operations;
+	int decode_scale;
+	/** maximal sample value of the input file, -1 until it is read */
+	double input_max;
+	RawLayout raw_layout;
+	/** tile size of the raw output, -1 if the output is not raw */
+	int raw_tile_size;
+	/** result of the last chained operation, float holds all pixel types */
+	cimg_library::CImg<float> current;
+	RawPixelType current_type;
+	/** level 0 of input_pyramid */
+	cimg_library::CImg<float> pyramid_base;
+	std::unique_ptr<ImagePyramid> input_pyramid;
+};
+
+template <typename T>
+void harrisImage(ImageChain &chain, int threshold, HarrisCornerDetector::ResponseType type)
+{
+	//Load the image for processing
+	cimg_library::CImg<T> src;
+	chain.input(src);
+	HarrisCornerDetector::detect(src, threshold, type);
+	//Save the final image.
+	chain.output(src, type == HarrisCornerDetector::HARRIS ? "h" : "st");
 }
 
+template <typename T>
+void keypointImage(ImageChain &chain, float threshold, int radius, bool subpixel,
+				   const string &keypoint_path)
+{
+	cimg_library::CImg<T> src;
+	chain.input(src);
+	vector<Keypoint> kps = HarrisCornerDetector::detectKeypoints(src, threshold, radius,
+																 HarrisCornerDetector::HARRIS, subpixel);
+	KeypointIO::save(keypoint_path, kps);
+	HarrisCornerDetector::drawKeypoints(src, kps);
+	chain.output(src, "kp");
+}
+
+template <typename T>
+void dehazeImage(ImageChain &chain, const string &output_path, bool half_precision)
+{
+	//Load the image for processing
+	cimg_library::CImg<T> src;
+	chain.input(src);
+	SingleImageHazeRemoval<T> sihr(src, output_path, half_precision);
+	cimg_library::CImg<T> rad = sihr.dehaze();
+	//Save the final image.
+	chain.output(rad, "dh");
+}
 
 int main(int argc, const char *argv[])
 {
@@ -106,47 +537,282 @@ int main(int argc, const char *argv[])
 		string output_path = ap.resultByShortname("o")[0];
 		Argument *harrisArg = ap.argumentByName("harris");
 		Argument *stitchArg = ap.argumentByName("stitch");
+		Argument *shiTomasiArg = ap.argumentByName("shi-tomasi");
+		Argument *keypointsArg = ap.argumentByName("keypoints");
+		Argument *bestKeypointsArg = ap.argumentByName("best-keypoints");
+		Argument *harrisLaplaceArg = ap.argumentByName("harris-laplace");
+		Argument *matchArg = ap.argumentByName("match");
+		Argument *tiledKeypointsArg = ap.argumentByName("tiled-keypoints");
+		Argument *sequenceArg = ap.argumentByName("sequence");
 		bool harris = harrisArg->exists();
 		bool dehaze = ap.argumentByShortname("dh")->exists();
+		bool subpixel = ap.argumentByName("subpixel")->exists();
+		bool half_precision = ap.argumentByName("half-precision")->exists();
+		Argument *pixelTypeArg = ap.argumentByName("pixel-type");
+		Argument *scaleArg = ap.argumentByName("scale");
+		PixelType pixel_type = PIXEL_U8;
+		int scale = 1;
+		try
+		{
+			if (pixelTypeArg->exists())
+				pixel_type = parsePixelType(pixelTypeArg->getResult()[0]);
+			if (scaleArg->exists())
+				scale = parseScale(scaleArg->getResult()[0]);
+			//rejects invalid frame pattern before any output is written
+			if (sequenceArg->exists())
+				framePath(input_image, 0);
+		}
+		catch (const std::runtime_error &e)
+		{
+			std::cerr << e.what() << std::endl << std::endl;
+			ap.printUsage();
+			return EXIT_FAILURE;
+		}
 		
+		const char *image_operations[] = {"h", "st", "kp", "bk", "hl", "m", "sq", "dh", "wr", "s"};
+		int operations = 0;
+		for (size_t i = 0; i < sizeof(image_operations) / sizeof(image_operations[0]); ++i)
+		{
+			if (ap.argumentByShortname(image_operations[i])->exists())
+				++operations;
+		}
+		ImageChain chain(input_image, output_path, ap.argumentByName("chain")->exists(), operations,
+						 scale);
 		
 		if (harris)
 		{
-			//Load the image for processing
-			cimg_library::CImg<unsigned char> src(input_image.c_str());
-			int harris_threshold = atoi(harrisArg->getResult()[0].c_str());
-			HarrisCornerDetector::detect(src, harris_threshold);
-			//Save the final image.
-			src.save(output_path.c_str());
+			int threshold = atoi(harrisArg->getResult()[0].c_str());
+			if (pixel_type == PIXEL_U16)
+				harrisImage<unsigned short>(chain, threshold, HarrisCornerDetector::HARRIS);
+			else if (pixel_type == PIXEL_F32)
+				harrisImage<float>(chain, threshold, HarrisCornerDetector::HARRIS);
+			else
+				harrisImage<unsigned char>(chain, threshold, HarrisCornerDetector::HARRIS);
+		}
+		if (shiTomasiArg->exists())
+		{
+			int threshold = atoi(shiTomasiArg->getResult()[0].c_str());
+			if (pixel_type == PIXEL_U16)
+				harrisImage<unsigned short>(chain, threshold, HarrisCornerDetector::SHI_TOMASI);
+			else if (pixel_type == PIXEL_F32)
+				harrisImage<float>(chain, threshold, HarrisCornerDetector::SHI_TOMASI);
+			else
+				harrisImage<unsigned char>(chain, threshold, HarrisCornerDetector::SHI_TOMASI);
+		}
+		if (keypointsArg->exists())
+		{
+			vector<string> res = keypointsArg->getResult();
+			float threshold = atof(res[0].c_str());
+			int radius = atoi(res[1].c_str());
+			if (pixel_type == PIXEL_U16)
+				keypointImage<unsigned short>(chain, threshold, radius, subpixel, res[2]);
+			else if (pixel_type == PIXEL_F32)
+				keypointImage<float>(chain, threshold, radius, subpixel, res[2]);
+			else
+				keypointImage<unsigned char>(chain, threshold, radius, subpixel, res[2]);
+		}
+		if (bestKeypointsArg->exists())
+		{
+			vector<string> res = bestKeypointsArg->getResult();
+			cimg_library::CImg<unsigned char> src;
+			chain.input(src);
+			int count = atoi(res[0].c_str());
+			vector<Keypoint> candidates = HarrisCornerDetector::detectKeypoints(src, 0, 1,
+																				HarrisCornerDetector::HARRIS, subpixel);
+			vector<Keypoint> kps;
+			if (res[1] == "anms")
+				kps = KeypointSelector::selectANMS(candidates, src.width(), src.height(), count);
+			else
+				kps = KeypointSelector::selectBucketed(candidates, src.width(), src.height(), count);
+			KeypointIO::save(res[2], kps);
+			HarrisCornerDetector::drawKeypoints(src, kps);
+			chain.output(src, "bk");
+		}
+		if (harrisLaplaceArg->exists())
+		{
+			vector<string> res = harrisLaplaceArg->getResult();
+			cimg_library::CImg<unsigned char> src;
+			chain.input(src);
+			float threshold = atof(res[0].c_str());
+			int octaves = atoi(res[1].c_str());
+			HarrisLaplaceDetector hl(octaves);
+			vector<Keypoint> kps = hl.detect(chain.pyramid(), threshold);
+			KeypointIO::save(res[2], kps);
+			HarrisCornerDetector::drawKeypoints(src, kps);
+			chain.output(src, "hl");
+		}
+		if (matchArg->exists())
+		{
+			vector<string> res = matchArg->getResult();
+			int count = atoi(res[1].c_str());
+			cimg_library::CImg<unsigned char> src;
+			chain.input(src);
+			cimg_library::CImg<float> second(ImageCache::global().get<unsigned char>(res[0], scale));
+			ImagePyramid second_pyramid(second);
+			
+			HarrisLaplaceDetector hl;
+			vector<Keypoint> kps1 = KeypointSelector::selectBucketed(hl.detect(chain.pyramid(), 0), src.width(),
+																	  src.height(), count);
+			vector<BriefDescriptor> desc1 = BriefExtractor::compute(hl, kps1, true);
+			vector<Keypoint> kps2 = KeypointSelector::selectBucketed(hl.detect(second_pyramid, 0), second.width(),
+																	  second.height(), count);
+			vector<BriefDescriptor> desc2 = BriefExtractor::compute(hl, kps2, true);
+			
+			vector<DescriptorMatch> matches = BriefExtractor::match(desc1, desc2);
+			BriefExtractor::saveMatches(res[2], kps1, kps2, matches);
+			HarrisCornerDetector::drawKeypoints(src, kps1);
+			chain.output(src, "m");
+		}
+		if (tiledKeypointsArg->exists())
+		{
+			vector<string> res = tiledKeypointsArg->getResult();
+			float threshold = atof(res[0].c_str());
+			int radius = atoi(res[1].c_str());
+			int strip_height = atoi(res[2].c_str());
+			vector<Keypoint> kps;
+			bool tiff = false;
+#ifdef cimg_use_tiff
+			tiff = TiffTileSource<unsigned char>::isTiff(input_image);
+#endif
+			if (tiff || RawImage::isRaw(input_image))
+			{
+				Argument *tileCacheArg = ap.argumentByName("tile-cache");
+				size_t budget = tileCacheArg->exists() ?
+					(size_t)atoi(tileCacheArg->getResult()[0].c_str()) * 1024 * 1024 : TILE_CACHE_BUDGET;
+				RawImage raw;
+				std::unique_ptr<TileSource<unsigned char> > tiles;
+#ifdef cimg_use_tiff
+				if (tiff)
+					tiles.reset(new TiffTileSource<unsigned char>(input_image));
+#endif
+				if (!tiles)
+				{
+					raw.open(input_image);
+					tiles.reset(new RawTileSource<unsigned char>(raw));
+				}
+				TiledImage<unsigned char> image(*tiles, budget);
+				cimg_library::CImg<unsigned char> strip;
+				kps = HarrisCornerDetector::detectKeypointsStreaming(
+					[&](int y, int count, unsigned char *gray)
+					{
+						image.readRegion(0, y, image.width(), count, 0, strip);
+						Image luma(gray, image.width(), count);
+						ColorConversion::rgbToLuma(strip, luma);
+					}, image.width(), image.height(), threshold, radius, strip_height);
+			}
+			else
+			{
+				PnmReader reader(input_image);
+				int width = reader.width();
+				vector<unsigned char> pixels;
+				kps = HarrisCornerDetector::detectKeypointsStreaming(
+					[&](int y, int count, unsigned char *gray)
+					{
+						pixels.resize((size_t)count * width * reader.channels());
+						reader.readRows(pixels.data(), count);
+						for (int r = 0; r < count; ++r)
+						{
+							ColorConversion::interleavedToLuma(&pixels[(size_t)r * width * reader.channels()],
+															  reader.channels(), gray + (size_t)r * width, width);
+						}
+					}, width, reader.height(), threshold, radius, strip_height);
+			}
+			KeypointIO::save(res[3], kps);
+		}
+		if (sequenceArg->exists())
+		{
+			vector<string> res = sequenceArg->getResult();
+			int frames = atoi(res[0].c_str());
+			FILE *tracks_file = fopen(res[1].c_str(), "w");
+			if (!tracks_file)
+				throw std::runtime_error("Unable to open " + res[1] + " for writing.");
+			fprintf(tracks_file, "frame,id,x,y,age\n");
+			
+			CornerTracker tracker;
+			cimg_library::CImg<unsigned char> src;
+			for (int f = 0; f < frames; ++f)
+			{
+				ImageCache::load(framePath(input_image, f), scale, src);
+				cimg_library::CImg<unsigned char> gray1;
+				ColorConversion::rgbToLuma(src, gray1);
+				Image gray = Image::fromCImg(gray1);
+				
+				const vector<Track> &tracks = tracker.process(gray);
+				for (size_t t = 0; t < tracks.size(); ++t)
+				{
+					fprintf(tracks_file, "%d,%d,%g,%g,%d\n", f, tracks[t].id,
+							tracks[t].x, tracks[t].y, tracks[t].age);
+				}
+			}
+			fclose(tracks_file);
+			
+			vector<Keypoint> kps;
+			for (size_t t = 0; t < tracker.tracks().size(); ++t)
+			{
+				kps.push_back(Keypoint(tracker.tracks()[t].x, tracker.tracks()[t].y, 0));
+			}
+			HarrisCornerDetector::drawKeypoints(src, kps);
+			chain.output(src, "sq");
 		}
 		if (dehaze)
 		{
-			//Load the image for processing
-			cimg_library::CImg<unsigned char> src(input_image.c_str());
-			SingleImageHazeRemoval sihr(src, output_path);
-			sihr.dehaze();
-			//Save the final image.
-			src.save(output_path.c_str());
+			if (pixel_type == PIXEL_U16)
+				dehazeImage<unsigned short>(chain, output_path, half_precision);
+			else if (pixel_type == PIXEL_F32)
+				dehazeImage<float>(chain, output_path, half_precision);
+			else
+				dehazeImage<unsigned char>(chain, output_path, half_precision);
+		}
+		if (ap.argumentByName("write-raw")->exists())
+		{
+			vector<string> res = ap.argumentByName("write-raw")->getResult();
+			RawLayout layout = res[0] == "interleaved" ? RAW_INTERLEAVED : RAW_PLANAR;
+			int tile_size = atoi(res[1].c_str());
+			if (pixel_type == PIXEL_U16)
+				chain.writeRaw<unsigned short>(layout, tile_size);
+			else if (pixel_type == PIXEL_F32)
+				chain.writeRaw<float>(layout, tile_size);
+			else
+				chain.writeRaw<unsigned char>(layout, tile_size);
 		}
 		if (stitchArg->exists())
 		{
 			vector<string> res = stitchArg->getResult();
-			string input_path = input_image;
 			string stitch_path = res[0];
+			CImg<float> input_img;
+			chain.input(input_img, ImageCache::sampleMax(stitch_path));
 			string mask_path = res[1];
 			float tolerance = atof(res[2].c_str());
 			int display = atoi(res[3].c_str());
 							   
-			GradientStitcher gs = GradientStitcher(input_path,
-												   stitch_path,
-												   mask_path);
+			GradientStitcher gs = GradientStitcher(input_img,
+												   ImageCache::global().get<float>(stitch_path, scale),
+												   ImageCache::global().get<float>(mask_path, scale),
+												   half_precision);
 			CImg<unsigned char> output_img =
 			gs.stitchGaussSeidel(tolerance, display).normalize(0,255);
 			
-			output_img.save(output_path.c_str());
+			chain.output(output_img, "s");
 			
 		}
 		
+		if (pixel_type == PIXEL_U16)
+			chain.finish<unsigned short>();
+		else if (pixel_type == PIXEL_F32)
+			chain.finish<float>();
+		else
+			chain.finish<unsigned char>();
+		
+		if (ap.argumentByName("pool-stats")->exists())
+		{
+			BufferPool::Stats stats = BufferPool::global().stats();
+			std::cout << "buffer pool: " << stats.hits << " hits, " << stats.misses
+					  << " misses, " << stats.cached_bytes << " bytes cached, " << stats.evictions
+					  << " evicted" << std::endl;
+			ImageCache::Stats cache_stats = ImageCache::global().stats();
+			std::cout << "image cache: " << cache_stats.hits << " hits, " << cache_stats.misses
+					  << " decoded" << std::endl;
+		}
 
 	}
 